@@ -0,0 +1,209 @@
+/* -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+ * (c) 2014 Henner Zeller <h.zeller@acm.org>
+ * Creative commons BY-SA
+ */
+
+#include "clearance.h"
+
+#include <math.h>
+
+#include <algorithm>
+
+static const int kMaxCellsPerEdge = 16;
+
+// Squared distance of "p" to segment a-b; the closest point is stored in
+// "closest".
+static double SegmentDistance2(const Vector2D &p,
+                              const Vector2D &a, const Vector2D &b,
+                              Vector2D *closest) {
+  const Vector2D d = b - a;
+  const double len2 = d.x * d.x + d.y * d.y;
+  const double t = (len2 > 0)
+    ? ((p.x - a.x) * d.x + (p.y - a.y) * d.y) / len2 : 0;
+  // Ends exactly on the vertices, so that they are recognized as such.
+  if (t <= 0)
+    *closest = a;
+  else if (t >= 1)
+    *closest = b;
+  else
+    *closest = Vector2D(a.x + t * d.x, a.y + t * d.y);
+  const double dx = p.x - closest->x, dy = p.y - closest->y;
+  return dx * dx + dy * dy;
+}
+
+EdgeGrid::EdgeGrid(const Polygon &polygon, double cell_size)
+  : polygon_(polygon), cell_size_(cell_size), orientation_(1),
+    width_(0), height_(0) {
+  if (polygon_.size() < 2)
+    return;
+  Vector2D max = polygon_[0];
+  origin_ = polygon_[0];
+  double area = 0;
+  for (size_t i = 0; i < polygon_.size(); ++i) {
+    const Vector2D &a = polygon_[i];
+    const Vector2D &b = polygon_[(i + 1) % polygon_.size()];
+    area += a.x * b.y - b.x * a.y;
+    origin_.x = std::min(origin_.x, a.x); origin_.y = std::min(origin_.y, a.y);
+    max.x = std::max(max.x, a.x); max.y = std::max(max.y, a.y);
+  }
+  orientation_ = (area < 0) ? -1 : 1;
+
+  // Not too many cells for the number of edges.
+  const double extent_x = max.x - origin_.x, extent_y = max.y - origin_.y;
+  const double min_cell = sqrt(extent_x * extent_y / (kMaxCellsPerEdge
+                                                      * polygon_.size()));
+  cell_size_ = std::max(cell_size_, min_cell);
+  if (cell_size_ <= 0) cell_size_ = 1.0;
+  width_ = (int) (extent_x / cell_size_) + 1;
+  height_ = (int) (extent_y / cell_size_) + 1;
+
+  // Two passes: count edges per cell, then fill them in.
+  std::vector<int> fill(width_ * height_ + 1, 0);
+  for (int pass = 0; pass < 2; ++pass) {
+    for (size_t i = 0; i < polygon_.size(); ++i) {
+      const Vector2D &a = polygon_[i];
+      const Vector2D &b = polygon_[(i + 1) % polygon_.size()];
+      const int x0 = (int) ((std::min(a.x, b.x) - origin_.x) / cell_size_);
+      const int x1 = (int) ((std::max(a.x, b.x) - origin_.x) / cell_size_);
+      const int y0 = (int) ((std::min(a.y, b.y) - origin_.y) / cell_size_);
+      const int y1 = (int) ((std::max(a.y, b.y) - origin_.y) / cell_size_);
+      for (int y = y0; y <= y1; ++y) {
+        for (int x = x0; x <= x1; ++x) {
+          if (pass == 0)
+            ++fill[CellIndex(x, y)];
+          else
+            cell_edges_[fill[CellIndex(x, y)]++] = i;
+        }
+      }
+    }
+    if (pass == 0) {
+      cell_start_.resize(fill.size());
+      int total = 0;
+      for (size_t c = 0; c < fill.size(); ++c) {
+        cell_start_[c] = total;
+        total += fill[c];
+        fill[c] = cell_start_[c];
+      }
+      cell_edges_.resize(total);
+    }
+  }
+}
+
+double EdgeGrid::SignedDistance(const Vector2D &p, Vector2D *closest,
+                                int *edge) const {
+  if (width_ == 0)
+    return -HUGE_VAL;
+  const int n = polygon_.size();
+  double best = HUGE_VAL;   // Squared.
+  int best_edge = -1;
+  Vector2D best_point;
+  auto try_edge = [&](int i) {
+    Vector2D point;
+    const double d = SegmentDistance2(p, polygon_[i], polygon_[(i + 1) % n],
+                                      &point);
+    if (d < best) {
+      best = d;
+      best_edge = i;
+      best_point = point;
+    }
+  };
+  // Starting with a good guess, most cells are too far away to look at.
+  if (edge && *edge >= 0 && *edge < n) {
+    try_edge((*edge + n - 1) % n);
+    try_edge(*edge);
+    try_edge((*edge + 1) % n);
+  }
+
+  const int cx = std::max(0, std::min(width_ - 1,
+                                      (int) floor((p.x - origin_.x)
+                                                  / cell_size_)));
+  const int cy = std::max(0, std::min(height_ - 1,
+                                      (int) floor((p.y - origin_.y)
+                                                  / cell_size_)));
+  // Edges not seen in the rings before r are at least r - 1 cells away.
+  const int max_ring = std::max(width_, height_);
+  for (int r = 0; r <= max_ring; ++r) {
+    const double ring_distance = std::max(0, r - 1) * cell_size_;
+    if (best <= ring_distance * ring_distance)
+      break;
+    for (int y = cy - r; y <= cy + r; ++y) {
+      if (y < 0 || y >= height_)
+        continue;
+      const bool full_row = (y == cy - r || y == cy + r);
+      for (int x = cx - r; x <= cx + r; x += full_row ? 1 : 2 * r) {
+        if (x < 0 || x >= width_)
+          continue;
+        // Distance to the cell itself.
+        const double left = origin_.x + x * cell_size_;
+        const double bottom = origin_.y + y * cell_size_;
+        const double dx = std::max(0.0, std::max(left - p.x,
+                                                 p.x - left - cell_size_));
+        const double dy = std::max(0.0, std::max(bottom - p.y,
+                                                 p.y - bottom - cell_size_));
+        if (dx * dx + dy * dy >= best)
+          continue;
+        const int cell = CellIndex(x, y);
+        for (int e = cell_start_[cell]; e < cell_start_[cell + 1]; ++e)
+          try_edge(cell_edges_[e]);
+      }
+    }
+  }
+  if (closest) *closest = best_point;
+  if (edge) *edge = best_edge;
+  best = sqrt(best);
+  return IsInside(p, best_edge, best_point) ? best : -best;
+}
+
+// Positive if p is left of a->b, i.e. inside for counter-clockwise polygons.
+static double Side(const Vector2D &a, const Vector2D &b, const Vector2D &p) {
+  return (b.x - a.x) * (p.y - a.y) - (b.y - a.y) * (p.x - a.x);
+}
+
+bool EdgeGrid::IsInside(const Vector2D &p, int edge,
+                        const Vector2D &closest) const {
+  const int n = polygon_.size();
+  const Vector2D &a = polygon_[edge];
+  const Vector2D &b = polygon_[(edge + 1) % n];
+  // If the closest point is a vertex, both edges at it count: at a convex
+  // corner, p needs to be inside both, at a concave one inside either.
+  int vertex = -1;
+  if (closest.x == a.x && closest.y == a.y) vertex = edge;
+  if (closest.x == b.x && closest.y == b.y) vertex = (edge + 1) % n;
+  if (vertex < 0)
+    return Side(a, b, p) * orientation_ >= 0;
+  const Vector2D &prev = polygon_[(vertex + n - 1) % n];
+  const Vector2D &v = polygon_[vertex];
+  const Vector2D &next = polygon_[(vertex + 1) % n];
+  const bool in_prev = Side(prev, v, p) * orientation_ >= 0;
+  const bool in_next = Side(v, next, p) * orientation_ >= 0;
+  const bool convex = Side(prev, v, next) * orientation_ >= 0;
+  return convex ? (in_prev && in_next) : (in_prev || in_next);
+}
+
+Clearance PolygonClearance(const Polygon &inner, const Polygon &outer,
+                           double cell_size) {
+  Clearance result = { HUGE_VAL, Vector2D() };
+  if (inner.size() < 2 || outer.size() < 2)
+    return result;
+  // The closest approach is at a vertex of one of the outlines.
+  const EdgeGrid outer_grid(outer, cell_size);
+  int edge = -1;   // Neighboring vertices are close to the same edge.
+  for (const Vector2D &p : inner) {
+    const double d = outer_grid.SignedDistance(p, NULL, &edge);
+    if (d < result.distance) {
+      result.distance = d;
+      result.where = p;
+    }
+  }
+  const EdgeGrid inner_grid(inner, cell_size);
+  edge = -1;
+  for (const Vector2D &p : outer) {
+    Vector2D closest;
+    const double d = -inner_grid.SignedDistance(p, &closest, &edge);
+    if (d < result.distance) {
+      result.distance = d;
+      result.where = closest;
+    }
+  }
+  return result;
+}
@@ -0,0 +1,53 @@
+/* -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+ * (c) 2014 Henner Zeller <h.zeller@acm.org>
+ * Creative commons BY-SA
+ */
+#ifndef SHELL_EXTRUDE_CLEARANCE_H_
+#define SHELL_EXTRUDE_CLEARANCE_H_
+
+#include <vector>
+
+#include "multi-shell-extrude.h"
+
+// Spatial index of the edges of a polygon in a uniform grid, to find the
+// closest edge to a point. Only the cells around the point are looked at,
+// in growing rings until no closer edge can be found. Works best with a
+// cell size in the order of the expected distance.
+class EdgeGrid {
+public:
+  EdgeGrid(const Polygon &polygon, double cell_size);
+
+  // Distance of "p" to the outline of the polygon; positive inside,
+  // negative outside. The closest point on the outline is stored in
+  // "closest" if non-NULL.
+  // If "edge" is non-NULL, it is a guess of the closest edge (or -1) and
+  // receives the closest edge. Points along a line are fast that way.
+  double SignedDistance(const Vector2D &p, Vector2D *closest,
+                        int *edge = NULL) const;
+
+private:
+  int CellIndex(int x, int y) const { return y * width_ + x; }
+
+  // Is "p" inside, given that "closest" at "edge" is the closest point?
+  bool IsInside(const Vector2D &p, int edge, const Vector2D &closest) const;
+
+  const Polygon polygon_;
+  double cell_size_;
+  double orientation_;          // +1 counter-clockwise, -1 clockwise.
+  Vector2D origin_;
+  int width_, height_;
+  std::vector<int> cell_start_;  // Edges of cell i: [start[i], start[i+1])
+  std::vector<int> cell_edges_;  // Edge i goes from vertex i to i+1.
+};
+
+struct Clearance {
+  double distance;   // Negative if the outlines cross.
+  Vector2D where;    // Point on "inner" closest to "outer".
+};
+
+// Smallest distance between the outline of "inner" and "outer", which is
+// expected to contain "inner". Cell size as in EdgeGrid.
+Clearance PolygonClearance(const Polygon &inner, const Polygon &outer,
+                           double cell_size);
+
+#endif  // SHELL_EXTRUDE_CLEARANCE_H_
@@ -12,6 +12,7 @@
 #include <stdio.h>
 #include <getopt.h>
 
+#include <algorithm>
 #include <vector>
 
 using std::vector;
@@ -23,12 +24,20 @@ static ParamList *sRegisteredParameters = NULL;
 Parameter::Parameter(const char *option_name_in,
                      char option_char_in, const char *helptext_in)
   : option_name(option_name_in),
-    option_char(option_char_in), helptext(helptext_in) {
+    option_char(option_char_in), helptext(helptext_in),
+    on_commandline_(false) {
   if (sRegisteredParameters == NULL)
     sRegisteredParameters = new ParamList();
   sRegisteredParameters->push_back(this);
 }
 
+Parameter::~Parameter() {
+  ParamList::iterator found = std::find(sRegisteredParameters->begin(),
+                                        sRegisteredParameters->end(), this);
+  if (found != sRegisteredParameters->end())
+    sRegisteredParameters->erase(found);
+}
+
 // Some specializations
 template<> bool TypedParameter<std::string>::FromString(const char *s) {
   value_ = s;
@@ -152,6 +161,7 @@ bool SetParametersFromCommandline(int argc, char *argv[]) {
   bool success = true;
   int opt;
   int arg_idx = 0;
+  optind = 0;   // We might be called multiple times; start fresh.
   while ((opt = getopt_long(argc, argv, optstr, long_options, &arg_idx)) >= 0) {
     if (opt == '?') {
       success = false;
@@ -161,9 +171,79 @@ bool SetParametersFromCommandline(int argc, char *argv[]) {
       Parameter *const p = (*sRegisteredParameters)[i];
       if (opt == p->option_char || opt == (int) (i + 256)) {
         p->FromString(optarg);
+        p->on_commandline_ = true;
       }
     }
   }
   delete [] long_options;
   return success;
 }
+
+// Remove whitespace at beginning and end.
+static std::string Trim(const std::string &s) {
+  const size_t start = s.find_first_not_of(" \t\r\n");
+  if (start == std::string::npos)
+    return "";
+  const size_t end = s.find_last_not_of(" \t\r\n");
+  return s.substr(start, end - start + 1);
+}
+
+bool SetParametersFromConfigFile(const char *filename, const char *preset) {
+  FILE *in = fopen(filename, "r");
+  if (in == NULL) {
+    perror(filename);
+    return false;
+  }
+  bool success = true;
+  bool in_active_section = true;   // Before first section.
+  bool found_preset = (preset == NULL || *preset == '\0');
+  char buffer[1024];
+  int line_no = 0;
+  while (fgets(buffer, sizeof(buffer), in)) {
+    ++line_no;
+    const std::string line = Trim(buffer);
+    if (line.empty() || line[0] == '#')
+      continue;
+    if (line[0] == '[') {
+      const std::string section = Trim(line.substr(1, line.find(']') - 1));
+      in_active_section = (preset != NULL && section == preset);
+      found_preset |= in_active_section;
+      continue;
+    }
+    if (!in_active_section)
+      continue;
+    const size_t eq = line.find('=');
+    const std::string key = Trim(line.substr(0, eq));
+    const std::string value = (eq == std::string::npos)
+      ? "on"    // Just the name of a boolean parameter: switch it on.
+      : Trim(line.substr(eq + 1));
+    Parameter *param = NULL;
+    for (size_t i = 0; sRegisteredParameters && i < sRegisteredParameters->size();
+         ++i) {
+      Parameter *const p = (*sRegisteredParameters)[i];
+      if (p->option_name && key == p->option_name) {
+        param = p;
+        break;
+      }
+    }
+    if (param == NULL) {
+      fprintf(stderr, "%s:%d: unknown parameter '%s'\n",
+              filename, line_no, key.c_str());
+      success = false;
+      continue;
+    }
+    if (param->on_commandline())
+      continue;   // Commandline has precedence.
+    if (!param->FromString(value.c_str())) {
+      fprintf(stderr, "%s:%d: invalid value '%s' for '%s'\n",
+              filename, line_no, value.c_str(), key.c_str());
+      success = false;
+    }
+  }
+  fclose(in);
+  if (!found_preset) {
+    fprintf(stderr, "%s: no preset [%s]\n", filename, preset);
+    success = false;
+  }
+  return success;
+}
@@ -15,7 +15,13 @@ int ParameterUsage(const char *progname);
 
 // Set all parameters from commandline. Returns 'true' on success.
 bool SetParametersFromCommandline(int argc, char *argv[]);
-// TODO, others like SetParameterFromConfigFile()
+
+// Set parameters from config file with "long-option = value" lines. Lines
+// before the first "[section]" are always applied, lines in a section only if
+// it is named as "preset". Parameters already given on the commandline are
+// not changed. Empty lines and lines starting with '#' are ignored.
+// Returns 'true' on success, otherwise prints a message to stderr.
+bool SetParametersFromConfigFile(const char *filename, const char *preset);
 
 // Classes to deal with configuration parameters. In general we want the
 // parameters look like read-only values (they all have operator T())),
@@ -26,17 +32,24 @@ public:
   // Set parameter with default value, option name (can be NULL if no long
   // option), option char (short option), and helptext for user to show.
   Parameter(const char *short_name, char option_char, const char *helptext);
-  virtual ~Parameter() {}
+  virtual ~Parameter();   // Unregisters, so parameters can be re-created.
 
   virtual bool FromString(const char *s) = 0;  // parsing from some config input
   virtual std::string ToString() const = 0;    // print defaults.
   virtual bool RequiresValue() const = 0;
 
+  // Returns true if this parameter was given on the commandline.
+  bool on_commandline() const { return on_commandline_; }
+
 public:
   // public accessible const values.
   const char *const option_name;
   const char option_char;
   const char *const helptext;
+
+private:
+  friend bool SetParametersFromCommandline(int argc, char *argv[]);
+  bool on_commandline_;
 };
 
 // Fake parameter - placeholder for a headline displayed in list
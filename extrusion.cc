@@ -0,0 +1,26 @@
+/* -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+ * (c) 2014 Henner Zeller <h.zeller@acm.org>
+ * Creative commons BY-SA
+ */
+
+#include "extrusion.h"
+
+double CalcPolygonLen(const Polygon &polygon) {
+  double len = 0;
+  const int size = polygon.size();
+  if (size == 0)
+    return 0;
+  for (int i = 1; i < size; ++i) {
+    len += distance(polygon[i].x - polygon[i-1].x,
+                    polygon[i].y - polygon[i-1].y, 0);
+  }
+  // Back to the beginning.
+  len += distance(polygon[size-1].x - polygon[0].x,
+                  polygon[size-1].y - polygon[0].y, 0);
+  return len;
+}
+
+float GetLayerTemperature(float base_temp, float variation,
+                          float height, float noise_feature) {
+  return sin(2 * M_PI * height / noise_feature) * variation + base_temp;
+}
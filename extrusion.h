@@ -0,0 +1,207 @@
+/* -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+ * (c) 2014 Henner Zeller <h.zeller@acm.org>
+ * Creative commons BY-SA
+ */
+#ifndef SHELL_EXTRUDE_EXTRUSION_H_
+#define SHELL_EXTRUDE_EXTRUSION_H_
+
+#include <math.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "height-profile.h"
+#include "multi-shell-extrude.h"
+
+// Overlap of the wider/narrower lock part with the regular screw.
+static const double kLockOverlap = 3;
+
+// The total length of distance going through a polygon.
+double CalcPolygonLen(const Polygon &polygon);
+
+// Get temperature for layer. Right now, this is a simple sin(), but
+// could be something more pleasingly erratic, such as Perlin noise.
+float GetLayerTemperature(float base_temp, float variation,
+                          float height, float noise_feature);
+
+// How to print one shell, see Printer::Extrude().
+struct ExtrusionParams {
+  double feedrate;
+  double layer_height;
+  // If non-NULL, height of each layer (see PlanLayerHeights()), otherwise
+  // all are layer_height. The extrusion follows the layer height.
+  const std::vector<double> *layers;
+  double total_height;
+  double rotation_per_mm;
+  double lock_offset;
+  double fan_on_height;
+  double elephant_foot_multiplier;
+  double first_layer_feedrate_multiplier;
+
+  float base_temp;
+  float temp_variation;
+
+  // If non-NULL, the polygon changes with height.
+  const ShellProfile *profile;
+
+  // If preheat_tool >= 0, start heating it when reaching preheat_height.
+  int preheat_tool;
+  double preheat_temperature;
+  double preheat_height;
+
+  // If total_time > 0, progress is reported each layer; time_before is the
+  // time of everything printed before this shell.
+  double total_time;
+  double time_before;
+
+  // GCode is formatted on that many threads.
+  int threads;
+};
+
+// Requires: Polygon with centroid on (0,0)
+// Each printer calls this with its own type from Printer::Extrude(), so that
+// the calls per vertex can be inlined.
+template <typename PrinterType>
+void CreateExtrusion(const Polygon &extrusion_polygon,
+                     PrinterType *printer, const Vector2D &center,
+                     const ExtrusionParams &params) {
+  printer->Comment("Center X=%.1f Y=%.1f\n", center.x, center.y);
+  printer->SetColor(0, 0, 0);
+  const float z_bottom_offset = params.layer_height / 2;
+  bool fan_is_on = false;
+  printer->SwitchFan(false);
+  double height = 0;
+  double angle = 0;
+  double run_len = 0;
+  const bool do_lock = (params.lock_offset > 0);
+  double polygon_len = 0;
+  Polygon p; // active polygon.
+  enum State { START, WIDE_LOCK, NORMAL, NARROW_LOCK };
+  enum State state = START;
+  enum State prev_state;
+  bool preheat_pending = (params.preheat_tool >= 0);
+  // Speed stays the same for most vertices; only tell the printer changes.
+  double speed = -1;
+  auto set_speed = [&](double new_speed) {
+    if (new_speed != speed) {
+      printer->SetSpeed(new_speed);
+      speed = new_speed;
+    }
+  };
+  for (size_t layer = 0; height < params.total_height; ++layer) {
+    const double layer_height = (params.layers && layer < params.layers->size())
+      ? (*params.layers)[layer] : params.layer_height;
+    const double rotation_per_layer =
+      layer_height * params.rotation_per_mm * 2 * M_PI;
+    // Thicker layers need proportionally more filament.
+    const double layer_multiplier = layer_height / params.layer_height;
+    printer->SetTemperature(GetLayerTemperature(
+        params.base_temp, params.temp_variation, height, 30));
+    if (preheat_pending && height >= params.preheat_height) {
+      printer->SetToolTemperature(params.preheat_tool,
+                                  params.preheat_temperature);
+      preheat_pending = false;
+    }
+    if (params.total_time > 0) {
+      const double elapsed = params.time_before
+        + printer->GetExtrusionDistance() / params.feedrate;
+      printer->SetProgress(elapsed / params.total_time,
+                           params.total_time - elapsed);
+    }
+    prev_state = state;
+
+    // Experimental. Locking screws do have smaller/larger diameter at their
+    // ends. This goes through the state transitions.
+    // What to print. For locking screw we're very simple: we just offset the
+    // polygon, but don't do any transition for now.
+    // TODO: re-arrange polygon to start at same angle.
+    switch (state) {
+    case START:
+      if (do_lock) {
+        state = WIDE_LOCK;
+        p = PolygonOffset(extrusion_polygon, params.lock_offset);
+      } else {
+        state = NORMAL;
+        p = extrusion_polygon;
+      }
+      break;
+
+    case WIDE_LOCK:
+      if (do_lock && height > kLockOverlap) {
+        p = extrusion_polygon;
+        state = NORMAL;
+      }
+      break;
+
+    case NORMAL:
+      if (do_lock && height > params.total_height - kLockOverlap) {
+        p = PolygonOffset(params.profile
+                          ? params.profile->PolygonAt(height)
+                          : extrusion_polygon, -params.lock_offset);
+        state = NARROW_LOCK;
+      } else if (params.profile && !params.profile->is_constant_shape()) {
+        // Interpolated from key polygons; cheap to do every layer.
+        params.profile->PolygonAt(height, &p);
+        polygon_len = CalcPolygonLen(p);
+      }
+      break;
+    case NARROW_LOCK: /* terminal state */
+      break;
+    }
+
+    if (state != prev_state) {
+      polygon_len = CalcPolygonLen(p);
+      // First move slowly, so that we wipe potential nozzle leak extrusion
+      set_speed(std::min(params.feedrate / 3, 15.0));
+      printer->MoveTo(p[0] + center, height + z_bottom_offset);
+    }
+
+    for (int i = 0; i < (int)p.size(); ++i) {
+      if (i == 0) {
+        run_len = 0;
+      } else {
+        run_len += distance(p[i].x - p[i - 1].x, p[i].y - p[i - 1].y, 0);
+      }
+      const double fraction = run_len / polygon_len;
+      const double z = height + layer_height * fraction;
+      double a = angle + fraction * rotation_per_layer;
+      if (params.profile) a += params.profile->TwistAt(z);
+      const Vector2D point = rotate(p[i], a);
+      const bool is_initial_layers = z < 2 * params.layer_height;
+      // Speed: keep slow while initial layers, then lerp-ing up to full
+      // speed within 4 more layers
+      if (is_initial_layers) {
+        set_speed(params.feedrate * params.first_layer_feedrate_multiplier);
+      } else if (z < 4 * params.layer_height) {
+        const double range = 1.0 - params.first_layer_feedrate_multiplier;
+        const double lerp = (z - 2 *  params.layer_height)
+          / ((4 - 2) * params.layer_height);
+        set_speed(params.feedrate *
+                  (params.first_layer_feedrate_multiplier + lerp * range));
+      } else {
+        set_speed(params.feedrate);
+      }
+      // Start only extruding when min z-offset reached and also stop extruding
+      // at the top to wipe off excess
+      if (z > z_bottom_offset / 2 &&
+          z < params.total_height - 0.30 * layer_height) {
+        printer->ExtrudeTo(point + center, z,
+                           ((is_initial_layers)
+                            ? params.elephant_foot_multiplier
+                            : 1.0) * layer_multiplier);
+      } else {
+        // In the last layer, we stop extruding to have a smooth finish.
+        printer->MoveTo(point + center, z);
+      }
+    }
+
+    if (height > params.fan_on_height && !fan_is_on) {
+      printer->SwitchFan(true); // reached fan-on height: switch on.
+      fan_is_on = true;
+    }
+    height += layer_height;
+    angle += rotation_per_layer;
+  }
+}
+
+#endif  // SHELL_EXTRUDE_EXTRUSION_H_
@@ -0,0 +1,70 @@
+/* -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+ * (c) 2014 Henner Zeller <h.zeller@acm.org>
+ * Creative commons BY-SA
+ */
+#ifndef SHELL_EXTRUDE_FIXED_POLYGON_H_
+#define SHELL_EXTRUDE_FIXED_POLYGON_H_
+
+#include <vector>
+
+#include "multi-shell-extrude.h"
+#include "third_party/clipper.hpp"
+
+// Polygon in the fixed point integer representation the clipper library
+// works with. Operations that build on each other (offsets of offsets,
+// nested shells from the same base) should stay in this representation and
+// only convert to Polygon when it is needed for output. This avoids repeated
+// conversion and rounding, and makes results deterministic.
+typedef ClipperLib::Path FixedPolygon;
+typedef ClipperLib::Paths FixedPolygons;
+
+// Fixed point units per millimeter.
+static const double kFixedResolution = 1e4;
+
+FixedPolygon ToFixed(const Polygon &polygon);
+Polygon FromFixed(const FixedPolygon &polygon);
+
+// Convert into an existing polygon, re-using its allocated memory. Useful
+// in loops.
+void FromFixed(const FixedPolygon &polygon, Polygon *result);
+
+// Like PolygonOffset(), but on fixed point polygons.
+FixedPolygon FixedPolygonOffset(const FixedPolygon &in, double offset,
+                                OffsetType type = kOffsetRound);
+
+// Offset the same polygon by a number of different offsets. This batches
+// the calls: the path is added (cleaned, oriented) to one clipper offset
+// and the centroid for picking the result is computed once, but each offset
+// is still a complete clipper run from the polygon. Unlike
+// FixedConcentricRings(), the results are not derived from each other, so
+// every one is exact and does not pick up the extra vertices of round joins
+// made on the way; use this where the results are printed for many layers.
+// Returns one polygon per offset, in the same order; polygons that vanished
+// are empty.
+std::vector<FixedPolygon> FixedPolygonOffsets(const FixedPolygon &in,
+                                              const std::vector<double> &offsets,
+                                              OffsetType type = kOffsetRound);
+
+// Split "contours" into islands: connected parts, each the outline followed
+// by the holes within it. A contour inside another one is a hole, one inside
+// a hole is an island of its own. A single contour is returned as is.
+std::vector<FixedPolygons> FixedIslands(const FixedPolygons &contours);
+
+// Like FixedPolygonOffsets(), but for a region with holes as returned by
+// FixedIslands(). Offsetting can split a region into pieces or merge holes
+// away; returns per offset the outlines of all pieces, each starting
+// closest to the start of the region outline. Holes are not returned.
+std::vector<FixedPolygons> FixedRegionOffsets(const FixedPolygons &region,
+                                              const std::vector<double> &offsets,
+                                              OffsetType type = kOffsetRound);
+
+// Concentric rings around/inside the polygon for the given, decreasing
+// "offsets" (round joins). Instead of offsetting the original polygon each
+// time, each ring is derived from its neighbor closer to the original
+// polygon by the small difference; that is exact for round offsets as long
+// as the sign doesn't change, and much cheaper than offsetting by a large
+// amount. Returns one ring per offset; rings that vanished are empty.
+std::vector<FixedPolygon> FixedConcentricRings(const FixedPolygon &in,
+                                               const std::vector<double> &offsets);
+
+#endif  // SHELL_EXTRUDE_FIXED_POLYGON_H_
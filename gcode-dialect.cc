@@ -0,0 +1,131 @@
+/* -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+ * (c) 2014 Henner Zeller <h.zeller@acm.org>
+ * Creative commons BY-SA
+ */
+
+#include "gcode-dialect.h"
+#include "output-sink.h"
+
+#include <string.h>
+
+#include <vector>
+
+// Similar to the parameters, dialects are kept in a global list.
+typedef std::vector<const GCodeDialect*> DialectList;
+static DialectList *sRegisteredDialects = NULL;
+
+GCodeDialect::GCodeDialect(const char *name_in, const char *description_in)
+  : name(name_in), description(description_in) {
+  if (sRegisteredDialects == NULL)
+    sRegisteredDialects = new DialectList();
+  sRegisteredDialects->push_back(this);
+}
+
+const GCodeDialect *GCodeDialect::Find(const char *name) {
+  if (sRegisteredDialects == NULL)
+    return NULL;
+  for (size_t i = 0; i < sRegisteredDialects->size(); ++i) {
+    if (strcasecmp((*sRegisteredDialects)[i]->name, name) == 0)
+      return (*sRegisteredDialects)[i];
+  }
+  return NULL;
+}
+
+std::string GCodeDialect::AvailableNames() {
+  std::string result;
+  if (sRegisteredDialects == NULL)
+    return result;
+  for (size_t i = 0; i < sRegisteredDialects->size(); ++i) {
+    if (i > 0) result.append(", ");
+    result.append((*sRegisteredDialects)[i]->name);
+  }
+  return result;
+}
+
+namespace {
+class MarlinDialect : public GCodeDialect {
+public:
+  MarlinDialect() : GCodeDialect("marlin", "Marlin, Repetier and similar") {}
+
+  virtual void Home(OutputSink *out) const {
+    out->Printf("G28\n");
+  }
+  virtual void BedLeveling(OutputSink *out) const {
+    out->Printf("M84 E         ; turn off e motor\n");
+    out->Printf("M109 S170     ; min temperature not have soft nozzle buggers\n");
+    out->Printf("G1 E-2 F2400  ; retract to not ooze while bed leveling\n");
+    out->Printf("M84 E\n");
+    out->Printf("G28 Z0        ; Establish a general Z0\n");
+    out->Printf("G29           ; bed levelling after everything is hot\n\n");
+  }
+  virtual void SetMotionLimits(OutputSink *out,
+                               double velocity, double accel) const {
+    if (velocity > 0) out->Printf("M203 X%.0f Y%.0f\n", velocity, velocity);
+    if (accel > 0) out->Printf("M204 P%.0f T%.0f\n", accel, accel);
+  }
+  virtual void SetPressureAdvance(OutputSink *out,
+                                  int extruder, double k) const {
+    out->Printf("M900 T%d K%.3f ; linear advance\n", extruder, k);
+  }
+};
+
+class KlipperDialect : public GCodeDialect {
+public:
+  KlipperDialect() : GCodeDialect("klipper", "Klipper") {}
+
+  virtual void Home(OutputSink *out) const {
+    out->Printf("G28\n");
+  }
+  virtual void BedLeveling(OutputSink *out) const {
+    out->Printf("M109 S170     ; min temperature not have soft nozzle buggers\n");
+    out->Printf("G1 E-2 F2400  ; retract to not ooze while bed leveling\n");
+    out->Printf("BED_MESH_CALIBRATE\n\n");
+  }
+  virtual void SetMotionLimits(OutputSink *out,
+                               double velocity, double accel) const {
+    if (velocity <= 0 && accel <= 0)
+      return;
+    out->Printf("SET_VELOCITY_LIMIT");
+    if (velocity > 0) out->Printf(" VELOCITY=%.0f", velocity);
+    if (accel > 0) out->Printf(" ACCEL=%.0f", accel);
+    out->Printf("\n");
+  }
+  virtual void SetPressureAdvance(OutputSink *out,
+                                  int extruder, double k) const {
+    if (extruder == 0)
+      out->Printf("SET_PRESSURE_ADVANCE EXTRUDER=extruder ADVANCE=%.4f\n", k);
+    else
+      out->Printf("SET_PRESSURE_ADVANCE EXTRUDER=extruder%d ADVANCE=%.4f\n",
+             extruder, k);
+  }
+};
+
+class RepRapFirmwareDialect : public GCodeDialect {
+public:
+  RepRapFirmwareDialect() : GCodeDialect("rrf", "RepRapFirmware (Duet)") {}
+
+  virtual void Home(OutputSink *out) const {
+    out->Printf("G28\n");
+  }
+  virtual void BedLeveling(OutputSink *out) const {
+    out->Printf("M109 S170     ; min temperature not have soft nozzle buggers\n");
+    out->Printf("G1 E-2 F2400  ; retract to not ooze while bed leveling\n");
+    out->Printf("G28 Z         ; Establish a general Z0\n");
+    out->Printf("G29 S0        ; probe bed and activate height map\n\n");
+  }
+  virtual void SetMotionLimits(OutputSink *out,
+                               double velocity, double accel) const {
+    // RepRapFirmware takes speed limits in mm/min.
+    if (velocity > 0) out->Printf("M203 X%.0f Y%.0f\n", velocity * 60, velocity * 60);
+    if (accel > 0) out->Printf("M204 P%.0f T%.0f\n", accel, accel);
+  }
+  virtual void SetPressureAdvance(OutputSink *out,
+                                  int extruder, double k) const {
+    out->Printf("M572 D%d S%.3f\n", extruder, k);
+  }
+};
+
+MarlinDialect sMarlin;
+KlipperDialect sKlipper;
+RepRapFirmwareDialect sRepRapFirmware;
+}  // end anonymous namespace.
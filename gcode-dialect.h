@@ -0,0 +1,53 @@
+/* -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+ * (c) 2014 Henner Zeller <h.zeller@acm.org>
+ * Creative commons BY-SA
+ */
+#ifndef SHELL_EXTRUDE_GCODE_DIALECT_H_
+#define SHELL_EXTRUDE_GCODE_DIALECT_H_
+
+#include <string>
+
+class OutputSink;
+
+// The parts of GCode that differ between printer firmwares. The GCodePrinter
+// emits everything common (G1, M104 ...) itself and asks the dialect for the
+// rest, which is written to "out".
+//
+// Dialects register themselves by name at construction time, so to add a new
+// one, just create a static instance of a subclass in gcode-dialect.cc.
+class GCodeDialect {
+public:
+  GCodeDialect(const char *name, const char *description);
+  virtual ~GCodeDialect() {}
+
+  // Find dialect by name. Returns NULL if there is none with that name.
+  static const GCodeDialect *Find(const char *name);
+
+  // Comma separated list of all registered dialect names, for help texts.
+  static std::string AvailableNames();
+
+  // Printed in front of each comment line.
+  virtual const char *comment_start() const { return "; "; }
+
+  // Home all axes.
+  virtual void Home(OutputSink *out) const = 0;
+
+  // Establish Z0 and do bed leveling. Called with a warm, but not yet hot,
+  // nozzle.
+  virtual void BedLeveling(OutputSink *out) const = 0;
+
+  // Limit maximum velocity (mm/s) and acceleration (mm/s^2) of the
+  // firmware's motion planner.
+  virtual void SetMotionLimits(OutputSink *out,
+                               double velocity, double accel) const = 0;
+
+  // Set pressure (or 'linear') advance factor K for the given extruder. K
+  // is in seconds: extra filament pushed = K * filament speed.
+  virtual void SetPressureAdvance(OutputSink *out,
+                                  int extruder, double k) const = 0;
+
+  const char *const name;
+  const char *const description;
+};
+
+#endif  // SHELL_EXTRUDE_GCODE_DIALECT_H_
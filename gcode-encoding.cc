@@ -0,0 +1,324 @@
+/* -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+ * (c) 2014 Henner Zeller <h.zeller@acm.org>
+ * Creative commons BY-SA
+ */
+
+#include "gcode-encoding.h"
+
+#include <ctype.h>
+#include <stdint.h>
+
+#include <algorithm>
+
+#include "raster-image.h"   // Crc32()
+
+namespace {
+// After two signal bytes, the next byte is a command to the firmware.
+static const uint8_t kMeatPackSignal = 0xff;
+static const uint8_t kMeatPackEnablePacking = 0xfb;
+static const uint8_t kMeatPackDisablePacking = 0xfa;
+static const uint8_t kMeatPackEnableNoSpaces = 0xf7;
+static const int kMeatPackFullChar = 0xf;
+
+class MeatPackSink : public OutputSink {
+public:
+  explicit MeatPackSink(OutputSink *out) : out_(out) {
+    const char start[] = { (char) kMeatPackSignal, (char) kMeatPackSignal,
+                           (char) kMeatPackEnablePacking,
+                           (char) kMeatPackSignal, (char) kMeatPackSignal,
+                           (char) kMeatPackEnableNoSpaces };
+    out_->Write(start, sizeof(start));
+  }
+  virtual ~MeatPackSink() {
+    if (!line_.empty())
+      PackLine();
+    const char end[] = { (char) kMeatPackSignal, (char) kMeatPackSignal,
+                         (char) kMeatPackDisablePacking };
+    out_->Write(end, sizeof(end));
+  }
+
+  virtual void Write(const char *data, size_t len) {
+    for (const char *end = data + len; data < end; ++data) {
+      if (*data == '\n')
+        PackLine();
+      else
+        line_.push_back(*data);
+    }
+  }
+
+private:
+  // 4 bit code of character, kMeatPackFullChar if it needs to be sent as is.
+  // In no-spaces mode, 'E' takes the place of the space.
+  static int Nibble(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    switch (c) {
+    case '.':  return 0b1010;
+    case 'E':  return 0b1011;
+    case '\n': return 0b1100;
+    case 'G':  return 0b1101;
+    case 'X':  return 0b1110;
+    }
+    return kMeatPackFullChar;
+  }
+
+  void PackLine() {
+    size_t end = std::min(line_.find(';'), line_.size());
+    while (end > 0 && isspace(line_[end-1]))
+      --end;
+    size_t start = 0;
+    while (start < end && isspace(line_[start]))
+      ++start;
+    if (start == end) {
+      line_.clear();
+      return;
+    }
+    std::string text;
+    const bool is_move = (line_[start] == 'G');  // Doesn't need spaces.
+    for (size_t i = start; i < end; ++i) {
+      if (!(is_move && line_[i] == ' '))
+        text.push_back(line_[i]);
+    }
+    text.push_back('\n');
+    line_.clear();
+
+    // Two characters per byte, first in the lower nibble. Characters that
+    // can't be packed follow the byte. If the newline ends up in the lower
+    // nibble, the upper one is ignored.
+    packed_.clear();
+    for (size_t i = 0; i < text.size(); i += 2) {
+      const int first = Nibble(text[i]);
+      const int second = (i + 1 < text.size()) ? Nibble(text[i+1]) : 0;
+      packed_.push_back((second << 4) | first);
+      if (first == kMeatPackFullChar) packed_.push_back(text[i]);
+      if (second == kMeatPackFullChar) packed_.push_back(text[i+1]);
+    }
+    out_->Write(packed_.data(), packed_.size());
+  }
+
+  OutputSink *const out_;
+  std::string line_;
+  std::string packed_;
+};
+}  // end anonymous namespace.
+
+OutputSink *CreateMeatPackSink(OutputSink *out) {
+  return new MeatPackSink(out);
+}
+
+// Block types and parameters as defined in the binary GCode specification.
+enum {
+  BLOCK_FILE_METADATA = 0, BLOCK_GCODE = 1, BLOCK_SLICER_METADATA = 2,
+  BLOCK_PRINTER_METADATA = 3, BLOCK_PRINT_METADATA = 4, BLOCK_THUMBNAIL = 5
+};
+static const int kCompressionNone = 0;
+static const int kCompressionHeatshrink12_4 = 3;
+static const int kChecksumCRC32 = 1;
+static const int kMetadataEncodingINI = 0;
+static const int kGCodeEncodingNone = 0;
+static const int kThumbnailFormatPNG = 0;
+
+// Largest GCode block; what firmware is prepared to buffer.
+static const size_t kMaxGCodeBlock = 65536;
+
+static void AppendLittleEndian16(uint16_t value, std::string *out) {
+  out->push_back(value);
+  out->push_back(value >> 8);
+}
+
+static void AppendLittleEndian32(uint32_t value, std::string *out) {
+  out->push_back(value);
+  out->push_back(value >> 8);
+  out->push_back(value >> 16);
+  out->push_back(value >> 24);
+}
+
+namespace {
+// Writes bits MSB first as needed by heatshrink.
+class MsbBitWriter {
+public:
+  explicit MsbBitWriter(std::string *out) : out_(out), bits_(0), count_(0) {}
+  void Put(uint32_t value, int bits) {
+    while (bits--) {
+      bits_ = (bits_ << 1) | ((value >> bits) & 1);
+      if (++count_ == 8) {
+        out_->push_back(bits_);
+        bits_ = 0;
+        count_ = 0;
+      }
+    }
+  }
+  void Flush() {
+    if (count_ > 0) out_->push_back(bits_ << (8 - count_));
+    bits_ = 0;
+    count_ = 0;
+  }
+private:
+  std::string *const out_;
+  uint32_t bits_;
+  int count_;
+};
+}  // end anonymous namespace.
+
+// heatshrink compression with a window of 2^12 and lookahead of 2^4 bytes:
+// a 1 bit followed by a literal byte, or a 0 bit followed by the distance
+// and length (both minus one) of a back-reference. Earlier positions are
+// found by a hash of the next three bytes.
+static void HeatshrinkCompress(const std::string &in, std::string *out) {
+  const int kWindowBits = 12;
+  const int kLookaheadBits = 4;
+  const size_t kWindow = 1 << kWindowBits;
+  const size_t kMaxMatch = 1 << kLookaheadBits;
+  const int kHashBits = 13;
+  const int kMaxChain = 32;   // Good enough; GCode is repetitive.
+  const uint8_t *const data = (const uint8_t*) in.data();
+  const size_t size = in.size();
+  std::vector<int> head(1 << kHashBits, -1);
+  std::vector<int> previous(size, -1);
+  auto hash = [data](size_t pos) {
+    return ((data[pos] << 10) ^ (data[pos+1] << 5) ^ data[pos+2])
+      & ((1 << kHashBits) - 1);
+  };
+  auto remember = [&](size_t pos) {
+    if (pos + 3 > size) return;
+    const int h = hash(pos);
+    previous[pos] = head[h];
+    head[h] = pos;
+  };
+
+  MsbBitWriter bits(out);
+  size_t pos = 0;
+  while (pos < size) {
+    size_t best_length = 0, best_distance = 0;
+    if (pos + 3 <= size) {
+      const size_t max_length = std::min(kMaxMatch, size - pos);
+      int chain = kMaxChain;
+      for (int candidate = head[hash(pos)];
+           candidate >= 0 && pos - candidate <= kWindow && chain-- > 0;
+           candidate = previous[candidate]) {
+        size_t length = 0;
+        while (length < max_length
+               && data[candidate + length] == data[pos + length])
+          ++length;
+        if (length > best_length) {
+          best_length = length;
+          best_distance = pos - candidate;
+          if (length == max_length) break;
+        }
+      }
+    }
+    // A back-reference takes 17 bits, two literals 18.
+    if (best_length >= 2) {
+      bits.Put(0, 1);
+      bits.Put(best_distance - 1, kWindowBits);
+      bits.Put(best_length - 1, kLookaheadBits);
+      for (size_t i = 0; i < best_length; ++i)
+        remember(pos++);
+    } else {
+      bits.Put(1, 1);
+      bits.Put(data[pos], 8);
+      remember(pos++);
+    }
+  }
+  bits.Flush();
+}
+
+BinaryGCodeSink::BinaryGCodeSink(OutputSink *out)
+  : out_(out), header_written_(false) {
+  AddMetadata(FILE_METADATA, "Producer", "multi-shell-extrude");
+}
+
+BinaryGCodeSink::~BinaryGCodeSink() {
+  WriteHeaderBlocks();
+  if (!gcode_.empty())
+    WriteGCodeBlock(gcode_);
+}
+
+void BinaryGCodeSink::AddMetadata(MetadataBlock block, const std::string &key,
+                                  const std::string &value) {
+  metadata_[block].append(key).append("=").append(value).append("\n");
+}
+
+void BinaryGCodeSink::AddThumbnail(int width, int height,
+                                   const std::string &png) {
+  std::string block;
+  AppendLittleEndian16(kThumbnailFormatPNG, &block);
+  AppendLittleEndian16(width, &block);
+  AppendLittleEndian16(height, &block);
+  block.append(png);
+  thumbnail_blocks_.push_back(block);
+}
+
+void BinaryGCodeSink::Write(const char *data, size_t len) {
+  gcode_.append(data, len);
+  if (gcode_.size() < kMaxGCodeBlock)
+    return;
+  WriteHeaderBlocks();
+  // Blocks end on a line boundary, if possible.
+  while (gcode_.size() >= kMaxGCodeBlock) {
+    const size_t newline = gcode_.rfind('\n', kMaxGCodeBlock - 1);
+    const size_t block_size = (newline == std::string::npos)
+      ? kMaxGCodeBlock : newline + 1;
+    WriteGCodeBlock(gcode_.substr(0, block_size));
+    gcode_.erase(0, block_size);
+  }
+}
+
+void BinaryGCodeSink::WriteGCodeBlock(const std::string &gcode) {
+  std::string compressed;
+  HeatshrinkCompress(gcode, &compressed);
+  std::string params;
+  AppendLittleEndian16(kGCodeEncodingNone, &params);
+  WriteBlock(BLOCK_GCODE, kCompressionHeatshrink12_4, params, gcode.size(),
+             compressed);
+}
+
+void BinaryGCodeSink::WriteHeaderBlocks() {
+  if (header_written_)
+    return;
+  header_written_ = true;
+  std::string header("GCDE");
+  AppendLittleEndian32(1, &header);   // Version.
+  AppendLittleEndian16(kChecksumCRC32, &header);
+  out_->Write(header.data(), header.size());
+
+  // The order of blocks is given by the specification.
+  std::string params;
+  AppendLittleEndian16(kMetadataEncodingINI, &params);
+  const std::string &file_metadata = metadata_[FILE_METADATA];
+  WriteBlock(BLOCK_FILE_METADATA, kCompressionNone, params,
+             file_metadata.size(), file_metadata);
+  const std::string &printer_metadata = metadata_[PRINTER_METADATA];
+  WriteBlock(BLOCK_PRINTER_METADATA, kCompressionNone, params,
+             printer_metadata.size(), printer_metadata);
+  for (size_t i = 0; i < thumbnail_blocks_.size(); ++i) {
+    // Parameters are the first 6 bytes of what we kept.
+    const std::string &thumbnail = thumbnail_blocks_[i];
+    WriteBlock(BLOCK_THUMBNAIL, kCompressionNone, thumbnail.substr(0, 6),
+               thumbnail.size() - 6, thumbnail.substr(6));
+  }
+  const std::string &print_metadata = metadata_[PRINT_METADATA];
+  WriteBlock(BLOCK_PRINT_METADATA, kCompressionNone, params,
+             print_metadata.size(), print_metadata);
+  const std::string &slicer_metadata = metadata_[SLICER_METADATA];
+  WriteBlock(BLOCK_SLICER_METADATA, kCompressionNone, params,
+             slicer_metadata.size(), slicer_metadata);
+  thumbnail_blocks_.clear();
+}
+
+// Header, parameters, data and checksum over all of them.
+void BinaryGCodeSink::WriteBlock(int type, int compression,
+                                 const std::string &params,
+                                 size_t uncompressed_size,
+                                 const std::string &data) {
+  std::string block;
+  AppendLittleEndian16(type, &block);
+  AppendLittleEndian16(compression, &block);
+  AppendLittleEndian32(uncompressed_size, &block);
+  if (compression != kCompressionNone)
+    AppendLittleEndian32(data.size(), &block);
+  block.append(params);
+  block.append(data);
+  AppendLittleEndian32(Crc32(0, (const uint8_t*) block.data(), block.size()),
+                       &block);
+  out_->Write(block.data(), block.size());
+}
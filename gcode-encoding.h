@@ -0,0 +1,60 @@
+/* -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+ * (c) 2014 Henner Zeller <h.zeller@acm.org>
+ * Creative commons BY-SA
+ */
+#ifndef SHELL_EXTRUDE_GCODE_ENCODING_H_
+#define SHELL_EXTRUDE_GCODE_ENCODING_H_
+
+#include <string>
+#include <vector>
+
+#include "output-sink.h"
+
+// Compact encodings of GCode, to get files onto the printer faster. Both are
+// sinks that receive the GCode text and pass the encoded form on to "out",
+// which needs to outlive them. Encoding happens as the text comes in; only
+// the last incomplete line or block is kept, which is written on deletion.
+
+// MeatPack, as understood by Marlin and Prusa firmware when sent over a serial
+// line: the most common characters in GCode are packed into 4 bits each. The
+// stream starts with the command to switch packing on and ends switching it
+// off again. Comments and empty lines are dropped, spaces in G commands
+// are not needed.
+OutputSink *CreateMeatPackSink(OutputSink *out);
+
+// Binary GCode (.bgcode) as introduced by Prusa: a file header followed by
+// blocks, each with a CRC32 checksum. GCode is in blocks of up to 64k,
+// compressed with heatshrink. Metadata and thumbnails precede the GCode, so
+// they need to be added before the first GCode block is written.
+class BinaryGCodeSink : public OutputSink {
+public:
+  enum MetadataBlock {
+    FILE_METADATA, PRINTER_METADATA, PRINT_METADATA, SLICER_METADATA
+  };
+
+  explicit BinaryGCodeSink(OutputSink *out);
+  virtual ~BinaryGCodeSink();
+
+  // Key/value shown by printers and frontends.
+  void AddMetadata(MetadataBlock block,
+                   const std::string &key, const std::string &value);
+
+  // Add thumbnail, encoded as PNG.
+  void AddThumbnail(int width, int height, const std::string &png);
+
+  virtual void Write(const char *data, size_t len);
+
+private:
+  void WriteHeaderBlocks();
+  void WriteGCodeBlock(const std::string &gcode);
+  void WriteBlock(int type, int compression, const std::string &params,
+                  size_t uncompressed_size, const std::string &data);
+
+  OutputSink *const out_;
+  bool header_written_;
+  std::string metadata_[4];     // INI style "key=value\n" per MetadataBlock
+  std::vector<std::string> thumbnail_blocks_;   // params + PNG.
+  std::string gcode_;           // Not yet written.
+};
+
+#endif  // SHELL_EXTRUDE_GCODE_ENCODING_H_
@@ -0,0 +1,1710 @@
+/* -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+ * (c) 2014 Henner Zeller <h.zeller@acm.org>
+ * Creative commons BY-SA
+ */
+
+#include "generator.h"
+
+#include <assert.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "multi-shell-extrude.h"
+#include "printer.h"
+#include "clearance.h"
+#include "extrusion.h"
+#include "fixed-polygon.h"
+#include "gcode-dialect.h"
+#include "height-profile.h"
+#include "infill.h"
+#include "output-sink.h"
+#include "print-head.h"
+#include "raster-image.h"
+#include "result-cache.h"
+#include "travel.h"
+
+GeneratorConfig::GeneratorConfig()
+  : fun_init("AABBBAABBBAABBB"), thread_depth(-1), twist(0.0),
+    total_height(-1), pitch(30.0), initial_size(10.0),
+    center_offset(0.0, 0.0), auto_center(false), pump(0.0), screw_count(2),
+    initial_shell(0), shell_increment(1.2), lock_offset(-1), brim(0),
+    brim_spiral_factor(0.55), brim_smooth_radius(0), vessel(false),
+    vessel_layers(1),
+    layer_height(0.16), adaptive_layers(0), max_layer_height(0),
+    shell_thickness(0.8), feed_mm_per_sec(100),
+    min_layer_time(3), fan_on(0.3), elephant_foot_multiplier(0.9),
+    retract_amount(1.2), first_layer_feed_multiplier(0.7),
+    pressure_advance(0), software_advance(false),
+    nozzle_diameter(0.4), bed_temp(-1), temperature(190), temp_variation(0),
+    filament_diameter(1.75), machine_limit(150.0, 150.0),
+    head_offset(45.0, 45.0), gantry_height(0), edge_offset(5.0, 5.0),
+    tool_count(1),
+    preheat_time(60), dialect_name("marlin"), max_velocity(0), max_accel(0),
+    do_postscript(false), do_svg(false), png_resolution(4),
+    postscript_thick_factor(1.0), matryoshka(false), header_totals(false),
+    gcode_format("text"), check_clearance(true),
+    progress(false), dry_run(false), threads(0) {
+}
+
+// Report to log, if there is one.
+static void Log(OutputSink *log, const char *fmt, ...)
+  __attribute__ ((format (printf, 2, 3)));
+static void Log(OutputSink *log, const char *fmt, ...) {
+  if (log == NULL)
+    return;
+  va_list ap; va_start(ap, fmt); log->VPrintf(fmt, ap); va_end(ap);
+}
+
+// Travel from "from" to "to" (absolute positions) at height z. If we are
+// inside the combing region, we stay within it.
+static void CombTo(Printer *printer, const CombingPlanner &combing,
+                   const Vector2D &center_offset,
+                   const Vector2D &from, const Vector2D &to, float z_height) {
+  std::vector<Vector2D> path;
+  if (!combing.Plan(from - center_offset, to - center_offset, &path))
+    path.push_back(to - center_offset);
+  for (const Vector2D &p : path)
+    printer->MoveTo(center_offset + p, z_height);
+}
+
+// Spiral from outer_distance to inner_distance offset around the
+// target_polygon. If "combing" is given, the initial move from "*pos"
+// stays within it. Updates "*pos" to the end position.
+static void CreateBottomPlate(const Polygon &target_polygon,
+                              Printer *printer,
+                              const Vector2D &center_offset,
+                              float outer_distance, float inner_distance,
+                              float spiral_distance, float z_height,
+                              const CombingPlanner *combing, Vector2D *pos) {
+  bool is_first = true;
+  const Vector2D centroid = Centroid(target_polygon);
+  std::vector<double> ring_offsets;
+  for (float poffset = outer_distance;
+       poffset > inner_distance; poffset -= spiral_distance) {
+    ring_offsets.push_back(poffset);
+  }
+  const std::vector<FixedPolygon> rings
+    = FixedConcentricRings(ToFixed(target_polygon), ring_offsets);
+  Polygon p;  // Re-used for all rings.
+  for (const FixedPolygon &ring : rings) {
+    FromFixed(ring, &p);
+    if (p.size() == 0)
+      return;   // Natural end of moving towards center.
+    float run_len = 0;
+    const float polygon_len = CalcPolygonLen(p);
+    // fudging a spiral: we want that the distance from the center
+    // is one spiral_distance less in the end.
+    float outer_distance = (p[0] - centroid).magnitude();
+    for (int i = 0; i < (int) p.size(); ++i) {
+      if (i == 0) {
+        run_len = 0;
+      } else {
+        run_len += (p[i] - p[i-1]).magnitude();
+      }
+      Vector2D current_point_from_center = p[i] - centroid;
+      const double fraction = run_len / polygon_len;
+      float spiral_adjust = (outer_distance - fraction*spiral_distance)/outer_distance;
+      current_point_from_center = current_point_from_center * spiral_adjust;
+      Vector2D next_pos = center_offset + centroid + current_point_from_center;
+      if (is_first && combing)
+        CombTo(printer, *combing, center_offset, *pos, next_pos, z_height);
+      else if (is_first)
+        printer->MoveTo(next_pos, z_height);
+      else
+        printer->ExtrudeTo(next_pos, z_height, 1.0);
+      is_first = false;
+      *pos = next_pos;
+    }
+  }
+}
+
+// Print the lines of a rectilinear fill at the given height, travelling
+// between them within the combing region. Updates "*pos".
+static void CreateLineFill(const std::vector<LineSegment> &lines,
+                           Printer *printer, const Vector2D &center_offset,
+                           float z_height,
+                           const CombingPlanner &combing, Vector2D *pos) {
+  for (const LineSegment &line : lines) {
+    CombTo(printer, combing, center_offset, *pos, center_offset + line.from,
+           z_height);
+    *pos = center_offset + line.to;
+    printer->ExtrudeTo(*pos, z_height, 1.0);
+  }
+}
+
+// Adaptive layers: slope that results in the thinnest layers, and the
+// height difference used to determine the slope of the profile.
+static const double kForceThinLayers = 1e6;
+static const double kSlopeStep = 0.1;
+
+// Nested clearance check: layers between samples of the first pass.
+static const int kCoarseClearanceLayers = 16;
+
+// Parse comma separated list of values. Missing values at the end are filled
+// up with the last value given, or "default_value" if the list is empty.
+static bool ParseValueList(const std::string &list, int count,
+                           double default_value, std::vector<double> *result) {
+  result->clear();
+  const char *s = list.c_str();
+  while (*s) {
+    char *end;
+    result->push_back(strtod(s, &end));
+    if (end == s)
+      return false;
+    s = end;
+    if (*s == ',')
+      ++s;
+    else if (*s != '\0')
+      return false;
+  }
+  if ((int) result->size() > count)
+    return false;
+  while ((int) result->size() < count) {
+    result->push_back(result->empty() ? default_value : result->back());
+  }
+  return true;
+}
+
+// Per-tool settings from the comma separated lists in the config. Returns
+// false if they don't fit the number of tools.
+static bool ParseTools(const GeneratorConfig &config,
+                       std::vector<ToolSettings> *tools) {
+  std::vector<double> temperatures, retracts;
+  if (config.tool_count < 1
+      || !ParseValueList(config.tool_temperatures, config.tool_count,
+                         config.temperature, &temperatures)
+      || !ParseValueList(config.tool_retracts, config.tool_count,
+                         config.retract_amount, &retracts)) {
+    return false;
+  }
+  tools->clear();
+  for (int t = 0; t < config.tool_count; ++t) {
+    const ToolSettings settings = { temperatures[t], retracts[t] };
+    tools->push_back(settings);
+  }
+  return true;
+}
+
+// Parse thumbnail sizes such as "220x124,16x16". On error, returns false
+// and points "*error_at" to the problem.
+static bool ParseThumbnailSizes(const std::string &spec,
+                                std::vector<std::pair<int, int> > *sizes,
+                                const char **error_at) {
+  sizes->clear();
+  for (const char *s = spec.c_str(); *s; /**/) {
+    int width, height, consumed;
+    if (sscanf(s, "%dx%d%n", &width, &height, &consumed) != 2
+        || width <= 0 || height <= 0) {
+      *error_at = s;
+      return false;
+    }
+    sizes->push_back(std::make_pair(width, height));
+    s += consumed;
+    if (*s == ',') ++s;
+  }
+  return true;
+}
+
+static bool IsPreview(const GeneratorConfig &config) {
+  return config.do_postscript || config.do_svg || !config.png_view.empty();
+}
+
+bool ValidateConfig(const GeneratorConfig &config, OutputSink *log) {
+  if (config.total_height < 0) {
+    Log(log, "\n--height needs to be set\n\n");
+    return false;
+  }
+  if (!config.png_view.empty()
+      && config.png_view != "top" && config.png_view != "side") {
+    Log(log, "--png needs to be 'top' or 'side'\n");
+    return false;
+  }
+  if (config.matryoshka && !IsPreview(config)) {
+    Log(log, "Matryoshka mode only valid with preview output\n");
+    return false;
+  }
+  if (config.gcode_format != "text" && config.gcode_format != "binary"
+      && config.gcode_format != "meatpack") {
+    Log(log, "--gcode-format needs to be 'text', 'binary' or 'meatpack'\n");
+    return false;
+  }
+  if (config.adaptive_layers < 0 || (config.max_layer_height > 0
+                                      && config.max_layer_height
+                                      < config.layer_height)) {
+    Log(log, "--adaptive-layers needs to be positive and --max-layer-height "
+        "at least --layer-height\n");
+    return false;
+  }
+  Polygon footprint;
+  if (!config.head_footprint.empty()
+      && !PrintHead::ParseFootprint(config.head_footprint, &footprint)) {
+    Log(log, "--head-footprint needs to be at least three x,y points\n");
+    return false;
+  }
+  if (GCodeDialect::Find(config.dialect_name.c_str()) == NULL) {
+    Log(log, "Unknown --dialect '%s'. Available: %s\n",
+        config.dialect_name.c_str(), GCodeDialect::AvailableNames().c_str());
+    return false;
+  }
+  std::vector<ToolSettings> tools;
+  if (!ParseTools(config, &tools)) {
+    Log(log, "Need at least one tool and at most one "
+        "temperature/retract per tool.\n");
+    return false;
+  }
+  PiecewiseLinear offset_function(0.0), scale_function(1.0), twist_function(0.0);
+  if (!offset_function.Parse(config.offset_profile.c_str())
+      || !scale_function.Parse(config.scale_profile.c_str())
+      || !twist_function.Parse(config.twist_profile.c_str())) {
+    Log(log, "Profiles need to be of the form z:value,z:value,... "
+        "with increasing z\n");
+    return false;
+  }
+  if (scale_function.min_value() <= 0) {
+    Log(log, "--scale-profile needs to be positive.\n");
+    return false;
+  }
+  if (config.threads < 0) {
+    Log(log, "--threads can't be negative.\n");
+    return false;
+  }
+  std::vector<std::pair<int, int> > thumbnail_sizes;
+  const char *error_at;
+  if (!ParseThumbnailSizes(config.thumbnails, &thumbnail_sizes, &error_at)) {
+    Log(log, "Invalid --thumbnails size at '%s'\n", error_at);
+    return false;
+  }
+  return true;
+}
+
+// Top view of all shells nested around their rotation center, scaled to fit
+// the image. Used as thumbnail for printer displays.
+static void RenderThumbnail(const std::vector<FixedPolygon> &shells,
+                            double line_width_mm, RasterImage *image) {
+  double radius = 0;
+  for (size_t i = 0; i < shells.size(); ++i) {
+    const FixedPolygon &p = shells[i];
+    for (size_t v = 0; v < p.size(); ++v) {
+      radius = std::max(radius, distance(p[v].X / kFixedResolution,
+                                         p[v].Y / kFixedResolution, 0));
+    }
+  }
+  if (radius <= 0)
+    return;
+  const double cx = image->width() / 2.0, cy = image->height() / 2.0;
+  const double scale = 0.45 * std::min(image->width(), image->height()) / radius;
+  const double line_width = std::max(1.0, line_width_mm * scale);
+  for (size_t i = 0; i < shells.size(); ++i) {
+    const Polygon p = FromFixed(shells[i]);
+    for (size_t v = 0; v < p.size(); ++v) {
+      const Vector2D &from = p[v];
+      const Vector2D &to = p[(v + 1) % p.size()];
+      image->DrawLine(cx + from.x * scale, cy - from.y * scale,
+                      cx + to.x * scale, cy - to.y * scale,
+                      line_width, 0.9, 0.45, 0.1);
+    }
+  }
+}
+
+Polygon OffsetCenter(const Polygon& polygon, double x_offset, double y_offset) {
+  Polygon result;
+  result.reserve(polygon.size());
+  for (const Vector2D &p : polygon) {
+    result.push_back(Vector2D(p.x + x_offset, p.y + y_offset));
+  }
+  return result;
+}
+
+// Polygon moved by "offset" mm.
+static FixedPolygon Translated(const FixedPolygon &polygon,
+                               const Vector2D &offset) {
+  const ClipperLib::IntPoint shift(llround(offset.x * kFixedResolution),
+                                   llround(offset.y * kFixedResolution));
+  FixedPolygon result;
+  result.reserve(polygon.size());
+  for (const ClipperLib::IntPoint &p : polygon) {
+    result.push_back(ClipperLib::IntPoint(p.X + shift.X, p.Y + shift.Y));
+  }
+  return result;
+}
+
+// Read very simple polygons from file: essentially a sequence of x y
+// coordinates. An empty line starts the next contour, which can be a hole
+// or another island. Problems are reported to "log".
+static std::vector<Polygon> ReadContours(const std::string &filename,
+                                         double factor, OutputSink *log) {
+  std::vector<Polygon> contours;
+  FILE *in = fopen(filename.c_str(), "r");
+  if (!in) {
+    Log(log, "Can't open %s\n", filename.c_str());
+    return contours;
+  }
+  char buffer[256];
+  int line = 0;
+  bool next_contour = true;
+  while (fgets(buffer, sizeof(buffer), in)) {
+    ++line;
+    const char *start = buffer;
+    while (*start && isspace(*start))
+      start++;
+    if (*start == '\0') {
+      next_contour = true;
+      continue;
+    }
+    if (*start == '#')
+      continue;
+    Vector2D p;
+    if (sscanf(start, "%lf %lf", &p.x, &p.y) == 2) {
+      p.x *= factor;
+      p.y *= factor;
+      if (next_contour) contours.push_back(Polygon());
+      next_contour = false;
+      contours.back().push_back(p);
+    } else {
+      for (char *end = buffer + strlen(buffer) - 1; isspace(*end); end--) {
+        *end = '\0';
+      }
+      Log(log, "%s:%d not a comment and not coordinates: '%s'\n",
+          filename.c_str(), line, start);
+    }
+  }
+  fclose(in);
+  return contours;
+}
+
+// Pump a polygon as if it was not arranged a dot but a circle of radius pump_r
+Polygon RadialPumpPolygon(const Polygon& polygon, double pump_r) {
+  if (pump_r <= 0)
+    return polygon;
+  Polygon result;
+  result.reserve(polygon.size());
+  for (const Vector2D &p : polygon) {
+    double from_center = distance(p.x, p.y, 0);
+    double stretch = (from_center + pump_r) / from_center;
+    result.push_back(Vector2D(p.x * stretch, p.y * stretch));
+  }
+  return result;
+}
+
+// Determine radius of circumscribed circle
+double GetRadius(const Polygon &polygon) {
+  double dist = -1;
+  for (size_t i = 0; i < polygon.size(); ++i) {
+    dist = std::max(dist, distance(polygon[i].x, polygon[i].y, 0));
+  }
+  return dist;
+}
+
+// Change whenever the output for the same config changes, so that results
+// of older versions are not used from the disk cache anymore.
+static const char kCacheFormat[] = "multi-shell-extrude cache v2\n";
+
+static bool ReadFileContents(const std::string &filename, std::string *out) {
+  std::ifstream in(filename.c_str(), std::ios::binary);
+  if (!in.good())
+    return false;
+  std::ostringstream content;
+  content << in.rdbuf();
+  *out = content.str();
+  return true;
+}
+
+// Calls visitor->Field(name, &member) for all members of the config. Used
+// to convert to text and back, so anything that influences the output needs
+// to be in here: the text is used as key to cached results.
+template <class Config, class Visitor>
+static void VisitConfig(Config *c, Visitor *v) {
+  v->Field("fun_init", &c->fun_init);
+  v->Field("thread_depth", &c->thread_depth);
+  v->Field("twist", &c->twist);
+  v->Field("polygon_file", &c->polygon_file);
+  v->Field("total_height", &c->total_height);
+  v->Field("pitch", &c->pitch);
+  v->Field("initial_size", &c->initial_size);
+  v->Field("center_offset", &c->center_offset);
+  v->Field("auto_center", &c->auto_center);
+  v->Field("pump", &c->pump);
+  v->Field("screw_count", &c->screw_count);
+  v->Field("initial_shell", &c->initial_shell);
+  v->Field("shell_increment", &c->shell_increment);
+  v->Field("lock_offset", &c->lock_offset);
+  v->Field("brim", &c->brim);
+  v->Field("brim_spiral_factor", &c->brim_spiral_factor);
+  v->Field("brim_smooth_radius", &c->brim_smooth_radius);
+  v->Field("vessel", &c->vessel);
+  v->Field("vessel_layers", &c->vessel_layers);
+  v->Field("offset_profile", &c->offset_profile);
+  v->Field("scale_profile", &c->scale_profile);
+  v->Field("twist_profile", &c->twist_profile);
+  v->Field("layer_height", &c->layer_height);
+  v->Field("adaptive_layers", &c->adaptive_layers);
+  v->Field("max_layer_height", &c->max_layer_height);
+  v->Field("shell_thickness", &c->shell_thickness);
+  v->Field("feed_mm_per_sec", &c->feed_mm_per_sec);
+  v->Field("min_layer_time", &c->min_layer_time);
+  v->Field("fan_on", &c->fan_on);
+  v->Field("elephant_foot_multiplier", &c->elephant_foot_multiplier);
+  v->Field("retract_amount", &c->retract_amount);
+  v->Field("first_layer_feed_multiplier", &c->first_layer_feed_multiplier);
+  v->Field("pressure_advance", &c->pressure_advance);
+  v->Field("software_advance", &c->software_advance);
+  v->Field("nozzle_diameter", &c->nozzle_diameter);
+  v->Field("bed_temp", &c->bed_temp);
+  v->Field("temperature", &c->temperature);
+  v->Field("temp_variation", &c->temp_variation);
+  v->Field("filament_diameter", &c->filament_diameter);
+  v->Field("machine_limit", &c->machine_limit);
+  v->Field("head_offset", &c->head_offset);
+  v->Field("head_footprint", &c->head_footprint);
+  v->Field("gantry_height", &c->gantry_height);
+  v->Field("edge_offset", &c->edge_offset);
+  v->Field("tool_count", &c->tool_count);
+  v->Field("tool_temperatures", &c->tool_temperatures);
+  v->Field("tool_retracts", &c->tool_retracts);
+  v->Field("preheat_time", &c->preheat_time);
+  v->Field("dialect_name", &c->dialect_name);
+  v->Field("max_velocity", &c->max_velocity);
+  v->Field("max_accel", &c->max_accel);
+  v->Field("do_postscript", &c->do_postscript);
+  v->Field("do_svg", &c->do_svg);
+  v->Field("png_view", &c->png_view);
+  v->Field("png_resolution", &c->png_resolution);
+  v->Field("postscript_thick_factor", &c->postscript_thick_factor);
+  v->Field("matryoshka", &c->matryoshka);
+  v->Field("thumbnails", &c->thumbnails);
+  v->Field("header_totals", &c->header_totals);
+  v->Field("gcode_format", &c->gcode_format);
+  v->Field("check_clearance", &c->check_clearance);
+  v->Field("progress", &c->progress);
+  v->Field("dry_run", &c->dry_run);
+  v->Field("threads", &c->threads);
+  v->Field("description", &c->description);
+}
+
+// Writes "name=value" lines. Floats with enough digits to be exact; in
+// strings, newlines and backslashes are escaped.
+class ConfigWriter {
+public:
+  void Field(const char *name, const std::string *value) {
+    text.append(name).append("=");
+    for (char c : *value) {
+      if (c == '\n') text.append("\\n");
+      else if (c == '\\') text.append("\\\\");
+      else text.push_back(c);
+    }
+    text.append("\n");
+  }
+  void Field(const char *name, const float *value) {
+    Printf(name, "%.9g", *value);
+  }
+  void Field(const char *name, const int *value) {
+    Printf(name, "%d", *value);
+  }
+  void Field(const char *name, const bool *value) {
+    Printf(name, "%d", (int) *value);
+  }
+  void Field(const char *name, const Vector2D *value) {
+    char buffer[64];
+    snprintf(buffer, sizeof(buffer), "%.17g,%.17g", value->x, value->y);
+    Printf(name, "%s", buffer);
+  }
+
+  std::string text;
+
+private:
+  template <typename T> void Printf(const char *name, const char *fmt,
+                                    T value) {
+    char buffer[64];
+    snprintf(buffer, sizeof(buffer), fmt, value);
+    text.append(name).append("=").append(buffer).append("\n");
+  }
+};
+
+// Sets fields from "name=value" lines as written by the ConfigWriter.
+class ConfigReader {
+public:
+  explicit ConfigReader(const std::map<std::string, std::string> &values)
+    : values_(values), found_(0), success_(true) {}
+
+  void Field(const char *name, std::string *value) {
+    const std::string *s = Find(name);
+    if (s == NULL) return;
+    value->clear();
+    for (size_t i = 0; i < s->size(); ++i) {
+      if ((*s)[i] == '\\' && i + 1 < s->size()) {
+        ++i;
+        value->push_back((*s)[i] == 'n' ? '\n' : (*s)[i]);
+      } else {
+        value->push_back((*s)[i]);
+      }
+    }
+  }
+  void Field(const char *name, float *value) {
+    const std::string *s = Find(name);
+    if (s) success_ &= (sscanf(s->c_str(), "%f", value) == 1);
+  }
+  void Field(const char *name, int *value) {
+    const std::string *s = Find(name);
+    if (s) success_ &= (sscanf(s->c_str(), "%d", value) == 1);
+  }
+  void Field(const char *name, bool *value) {
+    const std::string *s = Find(name);
+    if (s) *value = (*s == "1");
+  }
+  void Field(const char *name, Vector2D *value) {
+    const std::string *s = Find(name);
+    if (s) success_ &= (sscanf(s->c_str(), "%lf,%lf",
+                               &value->x, &value->y) == 2);
+  }
+
+  // All values valid and used.
+  bool success() const { return success_ && found_ == values_.size(); }
+
+private:
+  const std::string *Find(const char *name) {
+    std::map<std::string, std::string>::const_iterator found
+      = values_.find(name);
+    if (found == values_.end())
+      return NULL;
+    ++found_;
+    return &found->second;
+  }
+
+  const std::map<std::string, std::string> &values_;
+  size_t found_;
+  bool success_;
+};
+
+std::string ConfigToString(const GeneratorConfig &config) {
+  ConfigWriter writer;
+  VisitConfig(&config, &writer);
+  return writer.text;
+}
+
+bool ConfigFromString(const std::string &text, GeneratorConfig *config) {
+  std::map<std::string, std::string> values;
+  std::istringstream in(text);
+  std::string line;
+  while (std::getline(in, line)) {
+    const size_t eq = line.find('=');
+    if (eq == std::string::npos)
+      return false;
+    values[line.substr(0, eq)] = line.substr(eq + 1);
+  }
+  ConfigReader reader(values);
+  VisitConfig(config, &reader);
+  return reader.success();
+}
+
+// A connected part of the input. Each island gets its own set of shells.
+struct Island {
+  FixedPolygons region;   // Outline and holes around its rotation center.
+  Vector2D position;      // Rotation center in the input.
+};
+
+// Part of the output printed on its own: a piece of an island shell.
+struct PrintObject {
+  PrintObject(int k, int i, const FixedPolygon &p)
+    : island(k), shell(i), polygon(p) {}
+  int island;
+  int shell;
+  FixedPolygon polygon;   // Empty if nothing is left at this offset.
+};
+
+// Largest distance of corresponding vertices; no point of one polygon is
+// further away from the other. HUGE_VAL if they don't have the same number
+// of vertices.
+static double MaxVertexDistance(const Polygon &a, const Polygon &b) {
+  if (a.size() != b.size())
+    return HUGE_VAL;
+  double result = 0;
+  for (size_t i = 0; i < a.size(); ++i) {
+    result = std::max(result, distance(a[i].x - b[i].x, a[i].y - b[i].y, 0));
+  }
+  return result;
+}
+
+// Neighboring shells of an island are printed separately and need to come
+// apart afterwards. Check that they keep at least the shell thickness
+// between them in every layer, with the shapes CreateExtrusion() prints
+// (profile, lock offsets). All shells rotate the same way, so the check is
+// done before rotating; only the reported angle includes it.
+// Logs the closest approach, with a warning if shells would be fused.
+static void VerifyNestedClearance(const GeneratorConfig &config,
+                                  const std::vector<PrintObject> &objects,
+                                  const std::vector<ShellProfile*> &profiles,
+                                  OutputSink *log) {
+  // Pairs of object indices: a piece and a piece of the neighboring shell
+  // around it. Depending on the orientation of the input, shells grow or
+  // shrink with the offset.
+  // Shells that are not printed don't count.
+  auto printed = [&](size_t o) {
+    return !objects[o].polygon.empty()
+      && !(profiles[o] && profiles[o]->has_empty_key());
+  };
+  std::vector<std::pair<int, int> > pairs;
+  for (size_t inner = 0; inner < objects.size(); ++inner) {
+    const PrintObject &a = objects[inner];
+    if (!printed(inner)) continue;
+    for (size_t outer = 0; outer < objects.size(); ++outer) {
+      const PrintObject &b = objects[outer];
+      if (b.island != a.island || abs(b.shell - a.shell) != 1
+          || !printed(outer)
+          || (fabs(ClipperLib::Area(b.polygon))
+              <= fabs(ClipperLib::Area(a.polygon))))
+        continue;
+      // Vertices on the outline don't tell.
+      int inside = -1;
+      for (size_t v = 0; v < a.polygon.size() && inside < 0; ++v)
+        inside = ClipperLib::PointInPolygon(a.polygon[v], b.polygon);
+      if (inside > 0)
+        pairs.push_back(std::make_pair(inner, outer));
+    }
+  }
+  if (pairs.empty())
+    return;
+
+  // Shell shapes at the lock ends don't change with height.
+  const bool do_lock = (config.lock_offset > 0);
+  std::vector<Polygon> base(objects.size()), wide(objects.size()),
+    narrow(objects.size());
+  for (size_t o = 0; o < objects.size(); ++o) {
+    const ShellProfile *profile = profiles[o];
+    base[o] = profile ? profile->PolygonAt(0) : FromFixed(objects[o].polygon);
+    if (do_lock && !base[o].empty()) {
+      wide[o] = PolygonOffset(base[o], config.lock_offset);
+      narrow[o] = PolygonOffset(profile
+                                ? profile->PolygonAt(config.total_height
+                                                     - kLockOverlap)
+                                : base[o], -config.lock_offset);
+    }
+  }
+
+  // Checking every pair in every layer is expensive, but shapes change
+  // slowly with height. If no vertex of two shells moved by more than d
+  // since their last check, they can't be more than d closer than they
+  // were then. So a pair is only checked again if it could be closer than
+  // the closest seen so far.
+  // With a profile, all vertices move in every layer, so that doesn't skip
+  // much. So first only every few layers are checked, and those where the
+  // shapes change their course: at profile keys, lock ends and the top.
+  // Then every layer only around where each pair came closest.
+  // The scale of the profile is the same for all shells, so shapes are
+  // compared unscaled and the distance scaled afterwards.
+  const double cell_size
+    = std::max(0.05, (double) fabs(config.shell_increment));
+  std::vector<double> layer_z;
+  for (double z = 0; z < config.total_height; z += config.layer_height)
+    layer_z.push_back(z);
+  if (layer_z.empty())
+    return;
+  Clearance worst = { HUGE_VAL, Vector2D() };
+  double worst_z = 0;
+  int worst_pair = 0;
+  std::vector<Clearance> last_clearance(pairs.size());  // Unscaled.
+  std::vector<double> moved_since(pairs.size(), HUGE_VAL);
+  std::vector<double> pair_closest(pairs.size(), HUGE_VAL);
+  std::vector<int> pair_closest_layer(pairs.size(), 0);
+  std::vector<Polygon> shape(objects.size()), previous(objects.size());
+  std::vector<double> moved(objects.size());
+  std::vector<bool> active(pairs.size(), true);
+  auto check_layer = [&](size_t layer) {
+    const double z = layer_z[layer];
+    double scale = 1.0;
+    for (size_t o = 0; o < objects.size(); ++o) {
+      if (do_lock && z <= kLockOverlap) {
+        shape[o] = wide[o];
+      } else if (do_lock && z > config.total_height - kLockOverlap) {
+        shape[o] = narrow[o];
+      } else if (profiles[o]) {
+        profiles[o]->PolygonAt(z, &shape[o]);
+        scale = profiles[o]->ScaleAt(z);
+        for (Vector2D &v : shape[o]) {
+          v.x /= scale;
+          v.y /= scale;
+        }
+      } else {
+        shape[o] = base[o];
+      }
+      // Since the last layer we looked at.
+      moved[o] = MaxVertexDistance(previous[o], shape[o]);
+    }
+    for (size_t i = 0; i < pairs.size(); ++i) {
+      moved_since[i] += moved[pairs[i].first] + moved[pairs[i].second];
+      if (!active[i]
+          || scale * (last_clearance[i].distance - moved_since[i])
+          >= worst.distance)
+        continue;
+      if (moved_since[i] > 0) {
+        last_clearance[i] = PolygonClearance(shape[pairs[i].first],
+                                             shape[pairs[i].second],
+                                             cell_size);
+        moved_since[i] = 0;
+      }
+      const double scaled = scale * last_clearance[i].distance;
+      if (scaled < pair_closest[i]) {
+        pair_closest[i] = scaled;
+        pair_closest_layer[i] = layer;
+      }
+      if (scaled < worst.distance) {
+        worst.distance = scaled;
+        worst.where = last_clearance[i].where * scale;
+        worst_z = z;
+        worst_pair = i;
+      }
+    }
+    shape.swap(previous);
+  };
+
+  const size_t last_layer = layer_z.size() - 1;
+  std::vector<bool> coarse(layer_z.size(), false);
+  for (size_t layer = 0; layer <= last_layer; layer += kCoarseClearanceLayers)
+    coarse[layer] = true;
+  coarse[last_layer] = true;
+  auto add_coarse_around = [&](double z) {
+    const size_t below = std::upper_bound(layer_z.begin(), layer_z.end(), z)
+      - layer_z.begin();
+    if (below > 0) coarse[below - 1] = true;
+    if (below <= last_layer) coarse[below] = true;
+  };
+  if (do_lock) {
+    add_coarse_around(kLockOverlap);
+    add_coarse_around(config.total_height - kLockOverlap);
+  }
+  for (const ShellProfile *profile : profiles) {
+    if (profile == NULL) continue;
+    for (int k = 0; k < profile->key_count(); ++k)
+      add_coarse_around(profile->key_height(k));
+    break;  // All have the same keys.
+  }
+  for (size_t layer = 0; layer <= last_layer; ++layer) {
+    if (coarse[layer])
+      check_layer(layer);
+  }
+
+  std::fill(moved_since.begin(), moved_since.end(), HUGE_VAL);
+  std::fill(previous.begin(), previous.end(), Polygon());
+  for (size_t layer = 0; layer <= last_layer; ++layer) {
+    bool any_active = false;
+    for (size_t i = 0; i < pairs.size(); ++i) {
+      active[i] = (abs((int) layer - pair_closest_layer[i])
+                   < kCoarseClearanceLayers);
+      any_active |= active[i];
+    }
+    if (any_active)
+      check_layer(layer);
+  }
+  if (worst.distance == HUGE_VAL)
+    return;
+
+  // Where it is on the printed part.
+  const PrintObject &inner = objects[pairs[worst_pair].first];
+  const PrintObject &outer = objects[pairs[worst_pair].second];
+  double angle = (fabs(config.pitch) < 0.1)
+    ? 0 : worst_z / config.pitch * 2 * M_PI;
+  if (profiles[pairs[worst_pair].first])
+    angle += profiles[pairs[worst_pair].first]->TwistAt(worst_z);
+  const Vector2D where = rotate(worst.where, angle);
+  double degrees = atan2(where.y, where.x) * 180 / M_PI;
+  if (degrees < 0) degrees += 360;
+  if (worst.distance < config.shell_thickness) {
+    Log(log, "WARNING: Nested screws #%d and #%d are %.2fmm apart at height "
+        "%.1fmm, angle %.0f°; less than the shell thickness, they will "
+        "stick together.\n", inner.shell + 1, outer.shell + 1,
+        worst.distance, worst_z, degrees);
+  } else {
+    Log(log, "Nested screws are at least %.2fmm apart (gap %.2fmm); "
+        "closest #%d and #%d at height %.1fmm, angle %.0f°\n",
+        worst.distance, worst.distance - config.shell_thickness,
+        inner.shell + 1, outer.shell + 1, worst_z, degrees);
+  }
+}
+
+// Batch and sweep runs generate many variants in one process, and often only
+// parameters change that don't affect the polygons. So remember the last
+// islands and all shells offset from them.
+struct Generator::PolygonCache {
+  std::string key;   // Describes the parameters the islands come from.
+  std::vector<Island> islands;
+  // offset -> outlines of the pieces for each island.
+  std::map<double, std::vector<FixedPolygons> > shells;
+
+  // Serialize islands and shells to store them in a ResultCache.
+  std::string Serialize() const;
+  bool Deserialize(const std::string &data);
+};
+
+template <typename T> static void AppendValue(const T &value,
+                                              std::string *out) {
+  out->append((const char*) &value, sizeof(value));
+}
+template <typename T> static bool ReadValue(const std::string &in,
+                                            size_t *pos, T *value) {
+  if (*pos + sizeof(T) > in.size())
+    return false;
+  memcpy(value, in.data() + *pos, sizeof(T));
+  *pos += sizeof(T);
+  return true;
+}
+
+static void AppendPolygons(const FixedPolygons &polygons, std::string *out) {
+  AppendValue((uint32_t) polygons.size(), out);
+  for (const FixedPolygon &polygon : polygons) {
+    AppendValue((uint32_t) polygon.size(), out);
+    for (const ClipperLib::IntPoint &p : polygon) {
+      AppendValue(p.X, out);
+      AppendValue(p.Y, out);
+    }
+  }
+}
+static bool ReadPolygons(const std::string &in, size_t *pos,
+                         FixedPolygons *polygons) {
+  uint32_t count;
+  if (!ReadValue(in, pos, &count))
+    return false;
+  polygons->resize(count);
+  for (FixedPolygon &polygon : *polygons) {
+    if (!ReadValue(in, pos, &count))
+      return false;
+    polygon.resize(count);
+    for (ClipperLib::IntPoint &p : polygon) {
+      if (!ReadValue(in, pos, &p.X) || !ReadValue(in, pos, &p.Y))
+        return false;
+    }
+  }
+  return true;
+}
+
+std::string Generator::PolygonCache::Serialize() const {
+  std::string out;
+  AppendValue((uint32_t) islands.size(), &out);
+  for (const Island &island : islands) {
+    AppendValue(island.position.x, &out);
+    AppendValue(island.position.y, &out);
+    AppendPolygons(island.region, &out);
+  }
+  for (const auto &shell : shells) {
+    AppendValue(shell.first, &out);
+    for (const FixedPolygons &pieces : shell.second)
+      AppendPolygons(pieces, &out);
+  }
+  return out;
+}
+
+bool Generator::PolygonCache::Deserialize(const std::string &in) {
+  size_t pos = 0;
+  uint32_t count;
+  if (!ReadValue(in, &pos, &count))
+    return false;
+  islands.resize(count);
+  for (Island &island : islands) {
+    if (!ReadValue(in, &pos, &island.position.x)
+        || !ReadValue(in, &pos, &island.position.y)
+        || !ReadPolygons(in, &pos, &island.region))
+      return false;
+  }
+  shells.clear();
+  double offset;
+  while (ReadValue(in, &pos, &offset)) {
+    std::vector<FixedPolygons> &shell = shells[offset];
+    shell.resize(islands.size());
+    for (FixedPolygons &pieces : shell) {
+      if (!ReadPolygons(in, &pos, &pieces))
+        return false;
+    }
+  }
+  return pos == in.size();
+}
+
+Generator::Generator() : cache_(new PolygonCache()), result_cache_(NULL) {}
+Generator::~Generator() {
+  delete cache_;
+  delete result_cache_;
+}
+
+void Generator::SetCacheDir(const std::string &dir) {
+  delete result_cache_;
+  result_cache_ = dir.empty() ? NULL : new ResultCache(dir);
+}
+
+GenerateResult Generator::Generate(const GeneratorConfig &config,
+                                   OutputSink *out, OutputSink *log) {
+  if (!ValidateConfig(config, log))
+    return GENERATE_CONFIG_ERROR;
+  // Dry runs are for measuring, so they are always generated.
+  if (result_cache_ == NULL || config.dry_run)
+    return GenerateUncached(config, out, log);
+
+  // The same for all jobs with the same result: the commandline is left
+  // out of cached output, and threads don't change the output.
+  GeneratorConfig cached_config = config;
+  cached_config.description.clear();
+  GeneratorConfig key_config = cached_config;
+  key_config.threads = 0;
+  std::string key_data = kCacheFormat + ConfigToString(key_config);
+  if (!config.polygon_file.empty()) {
+    std::string content;
+    if (!ReadFileContents(config.polygon_file, &content))
+      return GenerateUncached(cached_config, out, log);  // Reports problem.
+    key_data.append(content);
+  }
+  const uint64_t key = ResultCache::Hash(key_data);
+  if (result_cache_->Fetch(key, ".out", out)) {
+    if (log) result_cache_->Fetch(key, ".log", log);
+    return GENERATE_OK;
+  }
+
+  // Record output and log while generating.
+  ResultCache::Recorder *out_recorder
+    = result_cache_->StartRecording(key, ".out", out);
+  ResultCache::Recorder *log_recorder
+    = result_cache_->StartRecording(key, ".log", log);
+  if (out_recorder == NULL || log_recorder == NULL) {
+    delete out_recorder;
+    delete log_recorder;
+    Log(log, "Can't create cache entries; not caching.\n");
+    return GenerateUncached(cached_config, out, log);
+  }
+  const GenerateResult result
+    = GenerateUncached(cached_config, out_recorder, log_recorder);
+  if (result == GENERATE_OK) {
+    // Log first: once the output is there, it will be used.
+    log_recorder->Commit();
+    out_recorder->Commit();
+  }
+  delete out_recorder;
+  delete log_recorder;
+  return result;
+}
+
+GenerateResult Generator::GenerateUncached(const GeneratorConfig &job_config,
+                                           OutputSink *out, OutputSink *log) {
+  GeneratorConfig config = job_config;   // Some values are adapted below.
+
+  if (config.thread_depth < 0)
+    config.thread_depth = config.initial_size / 5;
+
+  // Not actually printing, only visualizing.
+  const bool is_preview = IsPreview(config);
+
+  const GCodeDialect *dialect = GCodeDialect::Find(config.dialect_name.c_str());
+  std::vector<ToolSettings> tools;
+  ParseTools(config, &tools);
+
+  PiecewiseLinear offset_function(0.0), scale_function(1.0), twist_function(0.0);
+  offset_function.Parse(config.offset_profile.c_str());
+  scale_function.Parse(config.scale_profile.c_str());
+  twist_function.Parse(config.twist_profile.c_str());
+  const bool with_profile = (!offset_function.empty()
+                             || !scale_function.empty()
+                             || !twist_function.empty());
+
+  // Calculated values from input parameters.
+  const double nozzle_radius = config.nozzle_diameter / 2;
+  const double filament_radius = config.filament_diameter / 2;
+  const double shell_thickness_factor =
+    config.shell_thickness / config.nozzle_diameter;
+
+  config.matryoshka = config.matryoshka & is_preview;  // Formulate it this way.
+
+  PolygonCache &cache = *cache_;
+  char polygon_params[256];
+  snprintf(polygon_params, sizeof(polygon_params),
+           "|%.17g|%.17g|%.17g|%.17g|%d|%.17g|%.17g",
+           config.initial_size, config.thread_depth, config.twist, config.pump,
+           (int) config.auto_center,
+           config.center_offset.x, config.center_offset.y);
+  std::string polygon_key = (config.polygon_file.empty()
+                             ? "template:" + config.fun_init
+                             : "file:" + config.polygon_file)
+    + polygon_params;
+  if (!config.polygon_file.empty()) {
+    // Only the same if the content is the same; the file might have changed
+    // since the last job (or since it went to the disk cache).
+    std::string content;
+    ReadFileContents(config.polygon_file, &content);
+    char hash[32];
+    snprintf(hash, sizeof(hash), "|%016" PRIx64, ResultCache::Hash(content));
+    polygon_key.append(hash);
+  }
+  const uint64_t polygon_disk_key
+    = ResultCache::Hash(kCacheFormat + polygon_key);
+  bool polygons_changed = false;
+  if (polygon_key != cache.key && result_cache_ != NULL) {
+    std::string data;
+    if (result_cache_->Read(polygon_disk_key, ".shells", &data)
+        && cache.Deserialize(data)) {
+      cache.key = polygon_key;
+    }
+  }
+  if (polygon_key != cache.key) {
+    // Get contours we'll be working on; either from rotational input or file.
+    std::vector<Polygon> contours;
+    if (config.polygon_file.empty()) {
+      contours.push_back(RotationalPolygon(config.fun_init.c_str(),
+                                           config.initial_size,
+                                           config.thread_depth,
+                                           config.twist));
+    } else {
+      contours = ReadContours(config.polygon_file, config.initial_size, log);
+    }
+    if (contours.empty()) {
+      Log(log, "Polygon empty\n");
+      return GENERATE_FAILED;
+    }
+    for (const Polygon &contour : contours) {
+      if (contour.size() < 3) {
+        Log(log, "Polygon is a %sgon :) Need at least 3 vertices.\n",
+            contour.size() == 1 ? "Mono" : "Duo");
+        return GENERATE_FAILED;
+      }
+    }
+
+    // Add pump if needed.
+    if (config.pump > 0) {
+      for (Polygon &contour : contours)
+        contour = RadialPumpPolygon(contour, config.pump);
+    }
+
+    // The outline comes first.
+    if (config.auto_center) {
+      config.center_offset = Centroid(contours[0]);
+      config.center_offset = Vector2D(0,0) - config.center_offset;
+    }
+
+    // .. and offsetting
+    FixedPolygons fixed_contours;
+    for (const Polygon &contour : contours) {
+      fixed_contours.push_back(
+        ToFixed((config.center_offset.x != 0 || config.center_offset.y != 0)
+                ? OffsetCenter(contour, config.center_offset.x,
+                               config.center_offset.y)
+                : contour));
+    }
+    cache.key = polygon_key;
+    cache.islands.clear();
+    const std::vector<FixedPolygons> regions = FixedIslands(fixed_contours);
+    for (const FixedPolygons &region : regions) {
+      Island island;
+      island.region = region;
+      if (regions.size() > 1) {
+        // Islands are printed separately, each rotating around its own
+        // center. We remember where it was for the previews.
+        const Vector2D c = Centroid(FromFixed(region[0]));
+        const ClipperLib::IntPoint shift(llround(c.x * kFixedResolution),
+                                         llround(c.y * kFixedResolution));
+        for (FixedPolygon &contour : island.region) {
+          for (ClipperLib::IntPoint &p : contour) {
+            p.X -= shift.X;
+            p.Y -= shift.Y;
+          }
+        }
+        island.position = Vector2D(shift.X / kFixedResolution,
+                                   shift.Y / kFixedResolution);
+      }
+      cache.islands.push_back(island);
+    }
+    cache.shells.clear();
+    polygons_changed = true;
+  }
+
+  const std::vector<Island> &islands = cache.islands;
+  if (islands.empty()) {
+    Log(log, "Polygon empty\n");
+    return GENERATE_FAILED;
+  }
+
+  // Offset all nested shells we don't have yet in one go. Islands are
+  // independent, so we do them in parallel.
+  std::vector<double> shell_offsets, missing_offsets;
+  for (int i = 0; i < config.screw_count; ++i) {
+    shell_offsets.push_back(config.initial_shell + i * config.shell_increment);
+    if (cache.shells.find(shell_offsets.back()) == cache.shells.end())
+      missing_offsets.push_back(shell_offsets.back());
+  }
+  if (!missing_offsets.empty()) {
+    std::vector<std::vector<FixedPolygons> > island_offsets(islands.size());
+    std::atomic<size_t> next_island(0);
+    auto offset_islands = [&]() {
+      for (size_t k; (k = next_island++) < islands.size(); /**/) {
+        island_offsets[k] = FixedRegionOffsets(islands[k].region,
+                                               missing_offsets);
+      }
+    };
+    const size_t thread_count
+      = std::min<size_t>(islands.size(),
+                         std::max(1u, std::thread::hardware_concurrency()));
+    std::vector<std::thread> threads;
+    for (size_t t = 1; t < thread_count; ++t)
+      threads.push_back(std::thread(offset_islands));
+    offset_islands();
+    for (std::thread &t : threads)
+      t.join();
+    for (size_t i = 0; i < missing_offsets.size(); ++i) {
+      std::vector<FixedPolygons> &shell = cache.shells[missing_offsets[i]];
+      for (size_t k = 0; k < islands.size(); ++k)
+        shell.push_back(island_offsets[k][i]);
+    }
+    polygons_changed = true;
+  }
+  if (polygons_changed && result_cache_ != NULL) {
+    result_cache_->Store(polygon_disk_key, ".shells", cache.Serialize());
+  }
+
+  // Each piece of an island shell is printed on its own. Pieces of a shell
+  // that vanished are represented by an empty polygon.
+  std::vector<PrintObject> objects;
+  for (size_t k = 0; k < islands.size(); ++k) {
+    for (size_t i = 0; i < shell_offsets.size(); ++i) {
+      const FixedPolygons &pieces = cache.shells[shell_offsets[i]][k];
+      if (pieces.empty()) {
+        objects.push_back(PrintObject(k, i, FixedPolygon()));
+      }
+      for (const FixedPolygon &piece : pieces) {
+        objects.push_back(PrintObject(k, i, piece));
+      }
+    }
+  }
+  // The thumbnail shows the islands as they are arranged in the input.
+  std::vector<FixedPolygon> thumbnail_shells;
+  for (const PrintObject &object : objects) {
+    thumbnail_shells.push_back(
+      Translated(object.polygon, islands[object.island].position));
+  }
+
+  // Determine limits
+  // Profiles might make the polygon grow beyond the plain offset polygon.
+  const double profile_offset = std::max(0.0, offset_function.max_value());
+  const double profile_scale = std::max(1.0, scale_function.max_value());
+  // Radius of all pieces of the given shell of an island, including the
+  // profile offset.
+  auto shell_radius = [&](int island, int shell) {
+    const FixedPolygons pieces = (profile_offset > 0)
+      ? FixedRegionOffsets(islands[island].region,
+                           std::vector<double>(1, shell_offsets[shell]
+                                               + profile_offset))[0]
+      : cache.shells[shell_offsets[shell]][island];
+    double radius = -1;   // As GetRadius() of an empty polygon.
+    for (const FixedPolygon &piece : pieces)
+      radius = std::max(radius, GetRadius(FromFixed(piece)));
+    return radius;
+  };
+  if (config.matryoshka) {
+    double max_radius = 0;
+    for (size_t k = 0; k < islands.size(); ++k) {
+      const double radius
+        = shell_radius(k, shell_offsets.size() - 1) * profile_scale
+        + config.brim;
+      max_radius = std::max(max_radius,
+                            radius + islands[k].position.magnitude());
+    }
+    Vector2D poly_radius(max_radius + 5, max_radius + 5);
+    config.machine_limit = poly_radius * 2;
+    // In matryoshka-case, edge_offset is center
+    config.edge_offset = poly_radius;
+  } else if (config.head_footprint.empty()) {
+    const Vector2D max_machine = config.machine_limit - config.edge_offset;
+    Vector2D pos = config.edge_offset;
+    float radius = 0;
+    Vector2D screw_dimension;
+    for (size_t o = 0; o < objects.size(); ++o) {
+      const PrintObject &object = objects[o];
+      if (o == 0 || object.island != objects[o-1].island) {
+        radius = shell_radius(object.island, object.shell) * profile_scale;
+        screw_dimension = Vector2D(2 * (radius + config.brim),
+                                   2 * (radius + config.brim));
+      } else if (object.shell != objects[o-1].shell) {
+        screw_dimension = screw_dimension
+          + Vector2D(config.shell_increment, config.shell_increment)
+          * 2 * profile_scale;
+      }
+      Vector2D new_pos = pos + screw_dimension;
+      if (new_pos.x > max_machine.x || new_pos.y > max_machine.y) {
+        Log(log, "With currently configured bedsize and printhead-offset, "
+            "only %d screws fit (radius is %.1fmm)\n"
+            "Configure your machine constraints with -L <x/y> -o < dx,dy> "
+            "(currently -L %.0f,%.0f -o %.0f,%.0f)\n", (int) o, radius,
+            config.machine_limit.x, config.machine_limit.y,
+            config.head_offset.x, config.head_offset.y);
+        if (islands.size() == 1)
+          config.screw_count = object.shell;
+        objects.erase(objects.begin() + o, objects.end());
+        break;
+      }
+      pos = new_pos + config.head_offset;
+    }
+    pos = pos - config.head_offset;
+    // Now, pos is the largest corner. We can offset
+    // the edge_offset now to the difference to center things.
+    config.edge_offset = config.edge_offset
+      + (max_machine - pos - config.edge_offset) / 2;
+  }
+
+  // Shell i is printed with tool i % tools. To minimize tool changes, we
+  // print all shells of one tool, then the next. The diagonal space needed
+  // is the same in any order, so the limits above still hold.
+  std::vector<int> print_order;
+  for (int t = 0; t < config.tool_count; ++t) {
+    for (size_t o = 0; o < objects.size(); ++o) {
+      if (objects[o].shell % config.tool_count == t)
+        print_order.push_back(o);
+    }
+  }
+
+  // With a print head model, parts go as close as it allows instead of
+  // diagonally with a fixed head offset.
+  const bool place_by_head
+    = !config.matryoshka && !config.head_footprint.empty();
+  std::vector<Vector2D> positions(objects.size());
+  if (place_by_head) {
+    Polygon footprint;
+    PrintHead::ParseFootprint(config.head_footprint, &footprint);
+    const PrintHead head(footprint, config.gantry_height);
+    std::map<std::pair<int, int>, double> radius_cache;
+    std::vector<double> radii;
+    for (const int o : print_order) {
+      const std::pair<int, int> key(objects[o].island, objects[o].shell);
+      if (radius_cache.find(key) == radius_cache.end()) {
+        radius_cache[key] = shell_radius(key.first, key.second)
+          * profile_scale + config.brim;
+      }
+      radii.push_back(radius_cache[key]);
+    }
+    const Vector2D bed_min = config.edge_offset;
+    const Vector2D bed_max = config.machine_limit - config.edge_offset;
+    std::vector<Vector2D> placed;
+    const int fit = PlaceParts(head, config.total_height, radii,
+                               bed_min, bed_max, &placed);
+    if (fit < (int) print_order.size()) {
+      Log(log, "With currently configured bedsize and print head, "
+          "only %d screws fit\n"
+          "Configure your machine constraints with -L <x/y> "
+          "--head-footprint and --gantry-height\n", fit);
+      if (islands.size() == 1 && config.tool_count == 1)
+        config.screw_count = fit;
+      print_order.resize(fit);
+    }
+    // Center the whole layout on the bed.
+    Vector2D low = bed_max, high = bed_min;
+    for (int k = 0; k < fit; ++k) {
+      const Vector2D r(radii[k], radii[k]);
+      low.x = std::min(low.x, placed[k].x - r.x);
+      low.y = std::min(low.y, placed[k].y - r.y);
+      high.x = std::max(high.x, placed[k].x + r.x);
+      high.y = std::max(high.y, placed[k].y + r.y);
+    }
+    const Vector2D shift = ((bed_min + bed_max) - (low + high)) / 2;
+    for (int k = 0; k < fit; ++k)
+      positions[print_order[k]] = placed[k] + shift;
+  }
+
+  // Shapes along the height; built once for the clearance check and
+  // printing.
+  std::vector<ShellProfile*> profiles(objects.size(), NULL);
+  if (with_profile) {
+    for (size_t o = 0; o < objects.size(); ++o) {
+      if (!objects[o].polygon.empty()) {
+        profiles[o] = new ShellProfile(FromFixed(objects[o].polygon),
+                                       offset_function, scale_function,
+                                       twist_function);
+      }
+    }
+  }
+  if (config.check_clearance) {
+    VerifyNestedClearance(config, objects, profiles, log);
+  }
+
+  const double filament_extrusion_factor = shell_thickness_factor *
+    (nozzle_radius * (config.layer_height/2))
+    / (filament_radius*filament_radius);
+
+  constexpr float kHoverPos = 10.0;  // Hovering over screws while moving
+
+  // How much the whole system should rotate per mm height.
+  const double rotation_per_mm
+    = (fabs(config.pitch) < 0.1) ? 0 : 1.0 / config.pitch;
+
+  const double max_layer_height = (config.max_layer_height > 0)
+    ? config.max_layer_height : 0.75 * config.nozzle_diameter;
+
+  const int threads = (config.threads > 0)
+    ? config.threads : std::max(1u, std::thread::hardware_concurrency());
+
+  // Prints all objects. Adds up the estimated time and the travel for the
+  // filament use (weighted by layer height) in "total_time" and
+  // "total_travel". If "known_total_time" is > 0, the progress is reported
+  // to the printer.
+  auto print_objects = [&](Printer *printer, OutputSink *log,
+                           double known_total_time,
+                           double *total_time, double *total_travel) {
+    Vector2D center = config.edge_offset;
+    printer->SetSpeed(config.feed_mm_per_sec);  // initial speed.
+    int current_tool = 0;
+    for (size_t order_index = 0; order_index < print_order.size();
+         ++order_index) {
+      const PrintObject &object = objects[print_order[order_index]];
+      const int i = object.shell;
+      const int tool = i % config.tool_count;
+      if (tool != current_tool) {
+        printer->Comment("Switching to tool %d\n", tool);
+        printer->SelectTool(tool);
+        printer->SetToolTemperature(current_tool, 0);  // Not needed anymore.
+        current_tool = tool;
+      }
+      const float current_offset = shell_offsets[i];
+      const FixedPolygon &fixed_polygon = object.polygon;
+      Polygon polygon = FromFixed(fixed_polygon);
+      if (polygon.size() == 0) {
+        Log(log, "Polygon offset %.1f results in empty polygon\n",
+            config.initial_shell + i * config.shell_increment);
+        continue;
+      }
+      const ShellProfile *profile = profiles[print_order[order_index]];
+      if (profile) {
+        if (profile->has_empty_key()) {
+          Log(log, "Profile for offset %.1f results in empty polygon\n",
+              current_offset);
+          continue;
+        }
+        // We start at the bottom with the profile polygon.
+        polygon = profile->PolygonAt(0);
+      }
+      const double radius
+        = with_profile ? profile->MaxRadius() : GetRadius(polygon);
+      Vector2D screw_radius(radius + config.brim, radius + config.brim);
+      if (config.matryoshka) {
+        center = config.edge_offset + islands[object.island].position;
+      } else if (place_by_head) {
+        center = positions[print_order[order_index]];
+      } else {
+        // We start here.
+        center = center + screw_radius;
+      }
+      printer->MoveTo(center, (order_index > 0
+                               ? config.total_height + kHoverPos : kHoverPos));
+      const float polygon_len = CalcPolygonLen(polygon);
+      const float area = polygon_len * config.total_height * 2;  // in and out.
+      float layer_feedrate =  polygon_len / config.min_layer_time;
+      layer_feedrate = std::min(layer_feedrate, config.feed_mm_per_sec);
+      printer->ResetExtrude();
+      printer->SetSpeed(layer_feedrate);
+      if (islands.size() > 1) {
+        printer->Comment("Island #%d, screw #%d, polygon-offset=%.1f\n",
+                         object.island + 1, i+1,
+                         config.initial_shell + i * config.shell_increment);
+      } else {
+        printer->Comment("Screw #%d, polygon-offset=%.1f\n",
+                         i+1,
+                         config.initial_shell + i * config.shell_increment);
+      }
+      // Where the nozzle ends up after the bottom parts; we use that to find
+      // a close start of the shell.
+      Vector2D last_pos = center;
+      bool have_last_pos = false;
+      bool inside_part = false;   // last_pos within polygon, at low height.
+      const CombingPlanner combing(polygon);
+      float travel_z = 0;
+      if (config.vessel) {
+        const float spiral_layer_distance
+          = config.shell_thickness * config.brim_spiral_factor;
+        printer->Comment("Create vessel-bottom\n");
+        printer->SetColor(0.5, 0, 0.5);
+        // Layers alternate between the concentric spiral and line fills,
+        // which themselves alternate in direction.
+        // A single bottom layer is printed up to the shell path. With more,
+        // the shell is printed through the bottom layers afterwards, so
+        // they stay inside of it by half a shell width.
+        const float bottom_inset = (config.vessel_layers > 1)
+          ? config.shell_thickness / 2 : 0;
+        std::vector<LineSegment> line_fill[2];
+        if (config.vessel_layers > 1) {
+          const Polygon fill_region = FromFixed(
+            FixedPolygonOffset(fixed_polygon, -bottom_inset));
+          line_fill[0] = ScanlineIndex(fill_region, M_PI / 4,
+                                       spiral_layer_distance).Fill();
+          line_fill[1] = ScanlineIndex(fill_region, -M_PI / 4,
+                                       spiral_layer_distance).Fill();
+        }
+        float z = spiral_layer_distance / 2;
+        for (int layer = 0; layer < config.vessel_layers; ++layer) {
+          if (layer % 2 == 0) {
+            // The very first move comes from above, no need to comb.
+            CreateBottomPlate(polygon, printer, center,
+                              -bottom_inset, -radius, spiral_layer_distance, z,
+                              layer == 0 ? NULL : &combing, &last_pos);
+          } else {
+            CreateLineFill(line_fill[(layer / 2) % 2], printer, center, z,
+                           combing, &last_pos);
+          }
+          travel_z = z;
+          z += config.layer_height;
+        }
+        have_last_pos = true;
+        inside_part = combing.Contains(last_pos - center);
+        if (config.brim > 0) {
+          // The brim is outside the part, so lift to get there.
+          printer->GoZPos(std::max(2.0f, z + 1));
+          inside_part = false;
+        }
+      }
+
+      if (config.brim > 0) {
+        const float spiral_layer_distance
+          = config.shell_thickness * config.brim_spiral_factor;
+        int layers = (int) ceil(config.brim / spiral_layer_distance);
+        Polygon brim_polygon = polygon;
+        if (config.brim_smooth_radius > 0)
+          brim_polygon = FromFixed(
+            FixedPolygonOffset(FixedPolygonOffset(fixed_polygon,
+                                                  config.brim_smooth_radius),
+                               -config.brim_smooth_radius));
+        printer->Comment("Create brim\n");
+        printer->SetColor(0, 0.5, 0);
+        CreateBottomPlate(brim_polygon, printer, center,
+                          layers * spiral_layer_distance,
+                          spiral_layer_distance/2,
+                          spiral_layer_distance, spiral_layer_distance/2,
+                          NULL, &last_pos);
+        have_last_pos = true;
+      }
+
+      // Start the shell close to where we are. With a profile, all the
+      // polygons are aligned to the start of the initial one, so leave it.
+      if (have_last_pos && profile == NULL) {
+        polygon = RotatePolygonStart(polygon,
+                                     ClosestVertex(polygon, last_pos - center));
+      }
+      if (inside_part) {
+        // No need to lift: stay over the vessel bottom until we are there.
+        CombTo(printer, combing, center, last_pos, polygon[0] + center,
+               travel_z);
+      }
+      std::vector<double> layers;
+      if (config.adaptive_layers > 0) {
+        // How much the outermost point of the shell moves sideways per mm up:
+        // rotation, and the changes of the profile.
+        auto slope = [&](double z) {
+          // Speed ramp in the first layers and lock transitions are done
+          // with regular layers.
+          if (z < 4 * config.layer_height)
+            return kForceThinLayers;
+          if (config.lock_offset > 0
+              && (fabs(z - kLockOverlap) < max_layer_height
+                  || fabs(z - (config.total_height - kLockOverlap))
+                  < max_layer_height))
+            return kForceThinLayers;
+          double result = radius * 2 * M_PI * fabs(rotation_per_mm);
+          if (with_profile) {
+            const double dz = kSlopeStep;
+            result += fabs(offset_function.value(z + dz)
+                           - offset_function.value(z)) / dz;
+            result += radius * fabs(scale_function.value(z + dz)
+                                    - scale_function.value(z)) / dz;
+            result += radius * fabs(twist_function.value(z + dz)
+                                    - twist_function.value(z))
+              * M_PI / 180 / dz;
+          }
+          return result;
+        };
+        // Layers may shift by half the shell thickness.
+        layers = PlanLayerHeights(config.total_height, config.layer_height,
+                                  max_layer_height, config.adaptive_layers,
+                                  config.shell_thickness / 2, slope);
+      }
+      // Filament of thicker layers compared to all at layer_height.
+      const double extrusion_ratio = layers.empty()
+        ? 1.0 : config.total_height / (layers.size() * config.layer_height);
+      ExtrusionParams params = {
+        .feedrate = layer_feedrate,
+        .layer_height = config.layer_height,
+        .layers = layers.empty() ? NULL : &layers,
+        .total_height = config.total_height,
+        .rotation_per_mm = rotation_per_mm,
+        .lock_offset = config.lock_offset,
+        .fan_on_height = config.fan_on,
+        .elephant_foot_multiplier = config.elephant_foot_multiplier,
+        .first_layer_feedrate_multiplier = config.first_layer_feed_multiplier,
+        .base_temp = (float) tools[tool].temperature,
+        .temp_variation = config.temp_variation,
+        .profile = profile,
+        .preheat_tool = -1,
+        .preheat_temperature = 0,
+        .preheat_height = 0,
+        .total_time = known_total_time,
+        .time_before = *total_time,
+        .threads = threads
+      };
+      const int next_tool = (order_index + 1 < print_order.size())
+        ? objects[print_order[order_index + 1]].shell % config.tool_count
+        : tool;
+      if (next_tool != tool) {
+        // Last shell with this tool: heat up the next one in time.
+        const double layer_time = polygon_len / layer_feedrate;
+        const double average_layer_height = layers.empty()
+          ? config.layer_height : config.total_height / layers.size();
+        params.preheat_tool = next_tool;
+        params.preheat_temperature = tools[next_tool].temperature;
+        params.preheat_height = std::max(0.0, config.total_height
+                                         - (config.preheat_time / layer_time)
+                                         * average_layer_height);
+      }
+
+      printer->Extrude(polygon, center, params);
+      // Since last reset.
+      const double travel = printer->GetExtrusionDistance();
+      *total_travel += travel * extrusion_ratio;
+      *total_time += travel / layer_feedrate;  // roughly (without acceleration)
+      printer->SetSpeed(config.feed_mm_per_sec);
+      printer->Retract();
+      printer->GoZPos(config.total_height + kHoverPos);
+      if (!config.matryoshka && !place_by_head) {
+        center = center + screw_radius + config.head_offset;
+      }
+      if (!is_preview) {
+        Log(log, "Screw-surface (out+in) for offset %.1f: ~%.1f cm²\n",
+            current_offset, area / 100);
+      }
+    }
+  };
+
+  // Totals for the header and progress are needed before the output, so
+  // we generate all the toolpaths twice: first counting, without writing
+  // anything. This costs only a few percent of formatting and writing them.
+  double known_time = 0, known_travel = 0;
+  if (!is_preview && !config.dry_run
+      && (config.header_totals || config.progress)) {
+    PrinterCounts prepass_counts;
+    Printer *counter = CreateCountingPrinter(&prepass_counts);
+    print_objects(counter, NULL, 0, &known_time, &known_travel);
+    delete counter;
+  }
+
+  Printer *printer = NULL;
+  PrinterCounts counts;
+  if (config.dry_run) {
+    printer = CreateCountingPrinter(&counts);
+  } else if (config.do_postscript || config.do_svg) {
+    config.total_height = std::min(config.total_height,
+                                   3 * config.layer_height); // not needed more.
+    // no move lines w/ Matryoshka
+    const float line_thickness
+      = config.postscript_thick_factor * config.shell_thickness;
+    if (config.do_postscript) {
+      printer = CreatePostscriptPrinter(out, !config.matryoshka,
+                                        line_thickness);
+    } else {
+      printer = CreateSVGPrinter(out, !config.matryoshka, line_thickness);
+    }
+  } else if (!config.png_view.empty()) {
+    // Rasterizing is cheap, so we can show the full height.
+    const bool top_view = (config.png_view == "top");
+    printer = CreatePNGPrinter(out, top_view ? VIEW_TOP : VIEW_SIDE,
+                               !config.matryoshka,
+                               top_view
+                               ? config.shell_thickness : config.layer_height,
+                               config.png_resolution,
+                               config.total_height + kHoverPos + 5);
+  } else {
+    const GCodeEncoding encoding
+      = (config.gcode_format == "binary") ? GCODE_BINARY
+      : (config.gcode_format == "meatpack") ? GCODE_MEATPACK : GCODE_TEXT;
+    printer = CreateGCodePrinter(out, dialect, filament_extrusion_factor,
+                                 tools, config.bed_temp, encoding);
+  }
+  printer->Preamble(config.machine_limit, config.feed_mm_per_sec);
+  std::vector<std::pair<int, int> > thumbnail_sizes;
+  const char *error_at;
+  ParseThumbnailSizes(config.thumbnails, &thumbnail_sizes, &error_at);
+  for (size_t i = 0; i < thumbnail_sizes.size(); ++i) {
+    RasterImage thumbnail(thumbnail_sizes[i].first, thumbnail_sizes[i].second);
+    RenderThumbnail(thumbnail_shells, config.shell_thickness, &thumbnail);
+    printer->AddThumbnail(thumbnail);
+  }
+  if (config.header_totals) {
+    printer->SetTotals(known_time, known_travel * filament_extrusion_factor);
+  }
+
+  printer->Comment("https://github.com/hzeller/gcode-multi-shell-extrude\n");
+  printer->Comment("\n");
+  if (!config.description.empty()) {
+    printer->Comment("%s\n", config.description.c_str());
+    printer->Comment("\n");
+  }
+  if (!config.polygon_file.empty()) {
+    printer->Comment("Polygon from polygon-file '%s'\n",
+                     config.polygon_file.c_str());
+    printer->Comment("size-factor=%.1f\n", config.initial_size);
+  } else {
+    printer->Comment("Polygon from screw template '%s'\n",
+                     config.fun_init.c_str());
+    printer->Comment("thread-depth=%.1fmm size=%.1fmm (radius)\n",
+                     config.thread_depth, config.initial_size);
+  }
+  printer->Comment("h=%.1fmm n=%d (shell-increment=%.1fmm)\n",
+                   config.total_height, config.screw_count,
+                   config.shell_increment);
+  printer->Comment("feed=%.1fmm/s (maximum; layer time at least %.1f s)\n",
+                   config.feed_mm_per_sec, config.min_layer_time);
+  printer->Comment("pitch=%.1fmm/turn layer-height=%.3f\n",
+                   config.pitch, config.layer_height);
+  printer->Comment("machine limits: bed: (%.0f/%.0f):  "
+                  "head-offset: (%.0f,%.0f)\n",
+                   config.machine_limit.x, config.machine_limit.y,
+                   config.head_offset.x, config.head_offset.y);
+  if (place_by_head) {
+    printer->Comment("head-footprint: %s gantry-height: %.0f\n",
+                     config.head_footprint.c_str(), config.gantry_height);
+  }
+  printer->Comment("----\n");
+
+  printer->Init(config.machine_limit, config.feed_mm_per_sec);
+  if (config.max_velocity > 0 || config.max_accel > 0) {
+    printer->SetMotionLimits(config.max_velocity, config.max_accel);
+  }
+  if (config.pressure_advance > 0) {
+    printer->SetPressureAdvance(config.pressure_advance,
+                                !config.software_advance);
+  }
+
+  double total_time = 0;
+  double total_travel = 0;   // Weighted by layer height, for filament use.
+  print_objects(printer, log, config.progress ? known_time : 0,
+                &total_time, &total_travel);
+  if (config.progress) {
+    printer->SetProgress(1.0, 0);
+  }
+
+  for (ShellProfile *profile : profiles)
+    delete profile;
+
+  printer->Postamble();
+  if (!is_preview) {  // doesn't make sense to print for previews
+    int t = (int)total_time;
+    const int hours = t / 3600;
+    t %= 3600;
+    const int minutes = t / 60;
+    const int seconds = t % 60;
+    Log(log, "Total time >= %02d:%02d:%02d; %.2fm filament\n", hours,
+        minutes, seconds, total_travel * filament_extrusion_factor / 1000);
+  }
+  if (config.dry_run) {
+    Log(log, "Dry run: %ld moves, %ld extrusions (%.0fmm), "
+        "%ld speed changes\n", counts.moves, counts.extrusions,
+        counts.extrusion_mm, counts.speed_changes);
+  }
+  delete printer;
+  return GENERATE_OK;
+}
@@ -0,0 +1,152 @@
+/* -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+ * (c) 2014 Henner Zeller <h.zeller@acm.org>
+ * Creative commons BY-SA
+ */
+#ifndef SHELL_EXTRUDE_GENERATOR_H_
+#define SHELL_EXTRUDE_GENERATOR_H_
+
+#include <string>
+
+#include "multi-shell-extrude.h"   // Definition of Vector2D
+
+class OutputSink;
+class ResultCache;
+
+// Everything that describes a job. Members correspond to the commandline
+// options of the same name (see README), defaults are the same. New members
+// need to be added to VisitConfig() in generator.cc as well.
+struct GeneratorConfig {
+  GeneratorConfig();
+
+  // Screw-data from template
+  std::string fun_init;           // --screw-template
+  float thread_depth;             // initial_size/5 if negative.
+  float twist;
+
+  // Screw-data from polygon file; if set, the template is not used.
+  std::string polygon_file;
+
+  // General Parameters
+  float total_height;             // --height; needs to be set.
+  float pitch;
+  float initial_size;             // --size
+  Vector2D center_offset;
+  bool auto_center;
+  float pump;
+  int screw_count;                // --number
+  float initial_shell;            // --start-offset
+  float shell_increment;          // --offset
+  float lock_offset;
+  float brim;
+  float brim_spiral_factor;
+  float brim_smooth_radius;
+  bool vessel;
+  int vessel_layers;
+
+  // Height Profile
+  std::string offset_profile;
+  std::string scale_profile;
+  std::string twist_profile;
+
+  // Quality
+  float layer_height;
+  float adaptive_layers;          // Tolerance in mm; 0 = constant layers.
+  float max_layer_height;         // 0.75 * nozzle_diameter if 0.
+  float shell_thickness;
+  float feed_mm_per_sec;          // --feed-rate
+  float min_layer_time;           // --layer-time
+  float fan_on;                   // --fan-on-height
+  float elephant_foot_multiplier; // --slender-elephant
+  float retract_amount;           // --retract
+  float first_layer_feed_multiplier;  // --first-layer-speed
+  float pressure_advance;
+  bool software_advance;
+
+  // Printer Parameters
+  float nozzle_diameter;
+  float bed_temp;
+  float temperature;
+  float temp_variation;           // --temperature-variation
+  float filament_diameter;
+  Vector2D machine_limit;         // --bed-size
+  Vector2D head_offset;
+  std::string head_footprint;     // x,y,... around nozzle; replaces head_offset
+  float gantry_height;            // 0: gantry never in the way.
+  Vector2D edge_offset;
+  int tool_count;                 // --tools
+  std::string tool_temperatures;
+  std::string tool_retracts;
+  float preheat_time;
+  std::string dialect_name;       // --dialect
+  float max_velocity;
+  float max_accel;
+
+  // Output Options
+  bool do_postscript;             // --postscript
+  bool do_svg;                    // --svg
+  std::string png_view;           // --png
+  float png_resolution;
+  float postscript_thick_factor;  // --ps-thick-factor
+  bool matryoshka;                // --nested
+  std::string thumbnails;
+  bool header_totals;
+  std::string gcode_format;       // text, binary or meatpack
+  bool check_clearance;           // Log how far nested shells are apart.
+  bool progress;                  // M73 progress and remaining time.
+  bool dry_run;                   // No output; log toolpath counts.
+  int threads;                    // To format a shell; 0: one per CPU core.
+
+  // Shown as comment in the output header, e.g. the commandline. Not with
+  // a cache dir, as the output is shared by equivalent jobs.
+  std::string description;
+};
+
+// Text representation of the config, which ConfigFromString() reads back
+// into the same values. Returns false if the text is not valid.
+std::string ConfigToString(const GeneratorConfig &config);
+bool ConfigFromString(const std::string &text, GeneratorConfig *config);
+
+// Check the configuration. Returns true if it is valid, otherwise writes
+// a message to "log" (if non-NULL).
+bool ValidateConfig(const GeneratorConfig &config, OutputSink *log);
+
+enum GenerateResult {
+  GENERATE_OK,
+  GENERATE_CONFIG_ERROR,   // Invalid configuration, nothing written.
+  GENERATE_FAILED          // Could not create output, e.g. broken polygon.
+};
+
+// Generates GCode (or a preview) from a GeneratorConfig.
+//
+// Keeps the last polygons around, so subsequent jobs that only differ in
+// parameters not affecting the shape are faster. There is no global state,
+// so multiple generators can work in parallel; a single instance must only
+// be used by one thread at a time.
+class Generator {
+public:
+  Generator();
+  ~Generator();
+
+  // Keep finished outputs and polygons in this existing directory, and
+  // re-use them for jobs with the same configuration and input. Can be
+  // shared between generators. Empty string switches off (the default).
+  void SetCacheDir(const std::string &dir);
+
+  // Write output to "out". Progress and problems are reported to "log",
+  // which can be NULL.
+  GenerateResult Generate(const GeneratorConfig &config,
+                          OutputSink *out, OutputSink *log);
+
+private:
+  struct PolygonCache;
+
+  Generator(const Generator &);   // Not copyable.
+
+  GenerateResult GenerateUncached(const GeneratorConfig &config,
+                                  OutputSink *out, OutputSink *log);
+
+  PolygonCache *const cache_;
+  ResultCache *result_cache_;
+};
+
+#endif  // SHELL_EXTRUDE_GENERATOR_H_
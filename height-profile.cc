@@ -0,0 +1,280 @@
+/* -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+ * (c) 2014 Henner Zeller <h.zeller@acm.org>
+ * Creative commons BY-SA
+ */
+
+#include "height-profile.h"
+#include "fixed-polygon.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <iterator>
+
+// Maximum offset difference between two neighboring key polygons. In between,
+// we interpolate linearly, which is not quite what an offset would be, but
+// close enough if the steps are small.
+static const double kMaxOffsetStep = 0.25;
+
+// Layer planning: distance in z at which the slope is sampled, and how much
+// thicker a layer can be than the previous one.
+static const double kSlopeSampleDistance = 0.05;
+static const double kMaxLayerGrowth = 1.5;
+
+bool PiecewiseLinear::Parse(const char *spec) {
+  std::vector<std::pair<double, double> > result;
+  const char *s = spec;
+  while (*s) {
+    char *end;
+    const double z = strtod(s, &end);
+    if (end == s || *end != ':')
+      return false;
+    s = end + 1;
+    const double value = strtod(s, &end);
+    if (end == s)
+      return false;
+    if (!result.empty() && z <= result.back().first)
+      return false;  // Need to be strictly increasing.
+    result.push_back(std::make_pair(z, value));
+    s = end;
+    if (*s == ',')
+      ++s;
+    else if (*s != '\0')
+      return false;
+  }
+  knots_.swap(result);
+  return true;
+}
+
+double PiecewiseLinear::value(double z) const {
+  if (knots_.empty())
+    return default_value_;
+  if (z <= knots_.front().first)
+    return knots_.front().second;
+  if (z >= knots_.back().first)
+    return knots_.back().second;
+  std::vector<std::pair<double, double> >::const_iterator upper
+    = std::upper_bound(knots_.begin(), knots_.end(),
+                       std::make_pair(z, -HUGE_VAL));
+  const std::pair<double, double> &b = *upper;
+  const std::pair<double, double> &a = *(upper - 1);
+  const double fraction = (z - a.first) / (b.first - a.first);
+  return a.second + fraction * (b.second - a.second);
+}
+
+double PiecewiseLinear::max_value() const {
+  double result = knots_.empty() ? default_value_ : knots_[0].second;
+  for (size_t i = 0; i < knots_.size(); ++i)
+    result = std::max(result, knots_[i].second);
+  return result;
+}
+
+double PiecewiseLinear::min_value() const {
+  double result = knots_.empty() ? default_value_ : knots_[0].second;
+  for (size_t i = 0; i < knots_.size(); ++i)
+    result = std::min(result, knots_[i].second);
+  return result;
+}
+
+// Normalized running length [0..1) at each vertex of the closed polygon.
+static std::vector<double> ArcParameters(const Polygon &p) {
+  std::vector<double> result;
+  result.reserve(p.size());
+  double len = 0;
+  for (size_t i = 0; i < p.size(); ++i) {
+    if (i > 0) len += (p[i] - p[i-1]).magnitude();
+    result.push_back(len);
+  }
+  len += (p[0] - p[p.size()-1]).magnitude();
+  for (size_t i = 0; i < result.size(); ++i)
+    result[i] /= len;
+  return result;
+}
+
+// Point at normalized running length t on the closed polygon.
+static Vector2D PointAt(const Polygon &p, const std::vector<double> &params,
+                        double t) {
+  const size_t i = std::upper_bound(params.begin(), params.end(), t)
+    - params.begin() - 1;
+  const Vector2D &a = p[i];
+  const Vector2D &b = p[(i + 1) % p.size()];
+  const double t_end = (i + 1 < params.size()) ? params[i+1] : 1.0;
+  if (t_end <= params[i])
+    return a;
+  return a + (b - a) * ((t - params[i]) / (t_end - params[i]));
+}
+
+// Resample both polygons at the union of their vertex positions along the
+// circumference, so that they have the same number of vertices and
+// vertex-wise interpolation keeps the corners of both.
+static void MatchVertices(const Polygon &a, const Polygon &b,
+                          Polygon *a_out, Polygon *b_out) {
+  const std::vector<double> a_params = ArcParameters(a);
+  const std::vector<double> b_params = ArcParameters(b);
+  std::vector<double> merged;
+  merged.reserve(a_params.size() + b_params.size());
+  std::merge(a_params.begin(), a_params.end(),
+             b_params.begin(), b_params.end(), std::back_inserter(merged));
+  a_out->clear();
+  b_out->clear();
+  double last = -1;
+  for (size_t i = 0; i < merged.size(); ++i) {
+    if (merged[i] - last < 1e-9)
+      continue;
+    last = merged[i];
+    a_out->push_back(PointAt(a, a_params, last));
+    b_out->push_back(PointAt(b, b_params, last));
+  }
+}
+
+ShellProfile::ShellProfile(const Polygon &base,
+                           const PiecewiseLinear &offset,
+                           const PiecewiseLinear &scale,
+                           const PiecewiseLinear &twist_degrees)
+  : scale_(scale), twist_(twist_degrees), has_empty_key_(false) {
+  // Determine the key heights and their offsets.
+  std::vector<std::pair<double, double> > key_offsets;
+  const std::vector<std::pair<double, double> > &knots = offset.knots();
+  if (knots.empty()) {
+    key_offsets.push_back(std::make_pair(0.0, 0.0));
+  }
+  for (size_t i = 0; i < knots.size(); ++i) {
+    if (i > 0) {
+      const std::pair<double, double> &prev = knots[i-1];
+      const int steps = ceil(fabs(knots[i].second - prev.second)
+                             / kMaxOffsetStep);
+      for (int s = 1; s < steps; ++s) {
+        const double fraction = 1.0 * s / steps;
+        key_offsets.push_back(
+          std::make_pair(prev.first + fraction * (knots[i].first - prev.first),
+                         prev.second
+                         + fraction * (knots[i].second - prev.second)));
+      }
+    }
+    key_offsets.push_back(knots[i]);
+  }
+
+  if (key_offsets.size() == 1 && key_offsets[0].second == 0) {
+    keys_.push_back(std::make_pair(key_offsets[0].first, base));
+  } else {
+    std::vector<double> offsets;
+    for (size_t i = 0; i < key_offsets.size(); ++i)
+      offsets.push_back(key_offsets[i].second);
+    const std::vector<FixedPolygon> key_polygons
+      = FixedPolygonOffsets(ToFixed(base), offsets);
+    for (size_t i = 0; i < key_offsets.size(); ++i) {
+      keys_.push_back(std::make_pair(key_offsets[i].first,
+                                     FromFixed(key_polygons[i])));
+    }
+  }
+
+  for (size_t i = 0; i < keys_.size(); ++i) {
+    if (keys_[i].second.empty())
+      has_empty_key_ = true;
+  }
+  if (has_empty_key_)
+    return;  // No way to interpolate; see has_empty_key().
+  for (size_t i = 1; i < keys_.size(); ++i) {
+    KeyInterval interval;
+    interval.z_from = keys_[i-1].first;
+    interval.z_to = keys_[i].first;
+    MatchVertices(keys_[i-1].second, keys_[i].second,
+                  &interval.from, &interval.to);
+    intervals_.push_back(interval);
+  }
+}
+
+Polygon ShellProfile::PolygonAt(double z) const {
+  Polygon result;
+  PolygonAt(z, &result);
+  return result;
+}
+
+void ShellProfile::PolygonAt(double z, Polygon *result_ptr) const {
+  Polygon &result = *result_ptr;
+  result.clear();
+  if (keys_.size() == 1 || z <= keys_.front().first) {
+    result.assign(keys_.front().second.begin(), keys_.front().second.end());
+  } else if (z >= keys_.back().first) {
+    result.assign(keys_.back().second.begin(), keys_.back().second.end());
+  } else {
+    // Few keys; linear search is fine.
+    for (size_t i = 0; i < intervals_.size(); ++i) {
+      const KeyInterval &interval = intervals_[i];
+      if (z < interval.z_from || z >= interval.z_to)
+        continue;
+      const double fraction = ((z - interval.z_from)
+                               / (interval.z_to - interval.z_from));
+      result.reserve(interval.from.size());
+      for (size_t v = 0; v < interval.from.size(); ++v) {
+        result.push_back(interval.from[v]
+                         + (interval.to[v] - interval.from[v]) * fraction);
+      }
+      break;
+    }
+  }
+  if (!scale_.empty()) {
+    const double factor = scale_.value(z);
+    for (size_t i = 0; i < result.size(); ++i)
+      result[i] = Vector2D(result[i].x * factor, result[i].y * factor);
+  }
+}
+
+double ShellProfile::TwistAt(double z) const {
+  return twist_.value(z) * M_PI / 180.0;
+}
+
+double ShellProfile::ScaleAt(double z) const {
+  return scale_.value(z);
+}
+
+double ShellProfile::MaxRadius() const {
+  double radius = -1;
+  for (size_t i = 0; i < keys_.size(); ++i) {
+    const Polygon &p = keys_[i].second;
+    for (size_t v = 0; v < p.size(); ++v)
+      radius = std::max(radius, distance(p[v].x, p[v].y, 0));
+  }
+  return radius * scale_.max_value();
+}
+
+// Largest layer height at "slope": the step a layer of height h leaves on the
+// surface is h * slope / sqrt(1 + slope^2) deep, the shift to the layer
+// below is h * slope.
+static double AllowedLayerHeight(double slope, double max_height,
+                                 double tolerance, double max_shift) {
+  if (slope <= 0)
+    return max_height;
+  return std::min(tolerance * sqrt(1 + slope * slope) / slope,
+                  max_shift / slope);
+}
+
+std::vector<double> PlanLayerHeights(
+    double total_height, double min_height, double max_height,
+    double tolerance, double max_shift,
+    const std::function<double(double z)> &slope) {
+  std::vector<double> result;
+  double previous = min_height;
+  for (double z = 0; z < total_height; z += result.back()) {
+    double h = std::max(min_height,
+                        std::min(max_height, previous * kMaxLayerGrowth));
+    // The steepest part within the layer decides. A thinner layer might
+    // not reach that part, so try again until the height fits.
+    for (;;) {
+      const int samples = (int) ceil(h / kSlopeSampleDistance);
+      double max_slope = 0;
+      for (int i = 0; i <= samples; ++i) {
+        max_slope = std::max(max_slope, slope(z + h * i / samples));
+      }
+      const double allowed = AllowedLayerHeight(max_slope, max_height,
+                                                tolerance, max_shift);
+      if (h <= allowed || h <= min_height)
+        break;
+      h = std::max(min_height, allowed);
+    }
+    result.push_back(h);
+    previous = h;
+  }
+  return result;
+}
@@ -0,0 +1,121 @@
+/* -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+ * (c) 2014 Henner Zeller <h.zeller@acm.org>
+ * Creative commons BY-SA
+ */
+#ifndef SHELL_EXTRUDE_HEIGHT_PROFILE_H_
+#define SHELL_EXTRUDE_HEIGHT_PROFILE_H_
+
+#include <functional>
+#include <utility>
+#include <vector>
+
+#include "multi-shell-extrude.h"
+
+// A piecewise linear function of height, described by a string of
+// "z:value" pairs separated by comma, e.g. "0:1.0,30:1.2,60:1.0".
+// Outside the given range, the first/last value is held constant.
+class PiecewiseLinear {
+public:
+  explicit PiecewiseLinear(double default_value)
+    : default_value_(default_value) {}
+
+  // Parse from string. Heights need to be strictly increasing. Returns
+  // false and leaves the function unchanged on a parse error.
+  bool Parse(const char *spec);
+
+  bool empty() const { return knots_.empty(); }
+  double value(double z) const;
+
+  // Largest and smallest value the function takes anywhere.
+  double max_value() const;
+  double min_value() const;
+
+  // The (z, value) knots, sorted by z.
+  const std::vector<std::pair<double, double> > &knots() const {
+    return knots_;
+  }
+
+private:
+  double default_value_;
+  std::vector<std::pair<double, double> > knots_;
+};
+
+// The shape of a shell as function of height. The base polygon is offset,
+// scaled (around the rotation center at (0,0)) and additionally twisted as
+// described by the piecewise linear functions.
+//
+// Offsetting is expensive, so we only offset the base polygon for a small set
+// of key heights (the knots of the offset function, subdivided so that
+// neighboring keys don't differ too much). Polygons in between are linearly
+// interpolated vertex by vertex.
+class ShellProfile {
+public:
+  // The functions are copied, the base polygon is only used while
+  // constructing.
+  ShellProfile(const Polygon &base,
+               const PiecewiseLinear &offset,
+               const PiecewiseLinear &scale,
+               const PiecewiseLinear &twist_degrees);
+
+  // Returns true if the polygon does not change with height (no twist
+  // considered).
+  bool is_constant_shape() const { return keys_.size() == 1 && scale_.empty(); }
+
+  // Polygon at height z (without twist).
+  Polygon PolygonAt(double z) const;
+
+  // Same, but writing into an existing polygon to re-use its memory. Use
+  // this when calling for every layer.
+  void PolygonAt(double z, Polygon *result) const;
+
+  // Additional rotation at height z in radians.
+  double TwistAt(double z) const;
+
+  // Scale factor at height z, included in PolygonAt().
+  double ScaleAt(double z) const;
+
+  // Returns true if the offset makes the polygon vanish at some key height.
+  // PolygonAt() returns empty polygons around there, so such a profile
+  // can't be printed.
+  bool has_empty_key() const { return has_empty_key_; }
+
+  // Radius of circumscribed circle around all polygons we would ever return.
+  double MaxRadius() const;
+
+  // Number of key polygons, each offset from the base polygon.
+  int key_count() const { return keys_.size(); }
+
+  // Height of key "i". Between keys, polygons change linearly.
+  double key_height(int i) const { return keys_[i].first; }
+
+private:
+  struct KeyInterval {
+    double z_from, z_to;
+    // Both have the same number of vertices; corresponding vertices are
+    // interpolated.
+    Polygon from, to;
+  };
+
+  const PiecewiseLinear scale_;
+  const PiecewiseLinear twist_;
+  std::vector<std::pair<double, Polygon> > keys_;  // z -> offset polygon.
+  std::vector<KeyInterval> intervals_;
+  bool has_empty_key_;
+};
+
+// Layer heights to print up to "total_height", for a wall that leans by
+// slope(z) mm sideways per mm up. Each layer is as thick as possible within
+// [min_height, max_height], such that
+//  - the steps between layers deviate at most "tolerance" from the surface,
+//  - each layer is shifted at most "max_shift" against the one below, so
+//    that they still overlap.
+// Layers grow slowly, so a large slope(z) that forces thin layers (use a
+// large number, not infinity) is seen in time. The sum of the returned
+// heights reaches total_height in the same way as stepping with a constant
+// layer height would.
+std::vector<double> PlanLayerHeights(
+    double total_height, double min_height, double max_height,
+    double tolerance, double max_shift,
+    const std::function<double(double z)> &slope);
+
+#endif  // SHELL_EXTRUDE_HEIGHT_PROFILE_H_
@@ -0,0 +1,84 @@
+/* -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+ * (c) 2014 Henner Zeller <h.zeller@acm.org>
+ * Creative commons BY-SA
+ */
+
+#include "infill.h"
+
+#include <math.h>
+
+#include <algorithm>
+
+// We work in a coordinate system rotated by -angle, so that scan lines are
+// parallel to the u-axis (v = const).
+ScanlineIndex::ScanlineIndex(const Polygon &polygon, double angle,
+                             double spacing)
+  : angle_(angle), spacing_(spacing), v_min_(0), v_max_(0) {
+  if (polygon.size() < 3)
+    return;
+  Polygon rotated;
+  rotated.reserve(polygon.size());
+  for (const Vector2D &p : polygon)
+    rotated.push_back(rotate(p, -angle));
+
+  v_min_ = v_max_ = rotated[0].y;
+  for (const Vector2D &p : rotated) {
+    v_min_ = std::min(v_min_, p.y);
+    v_max_ = std::max(v_max_, p.y);
+  }
+
+  // Each scan line falls in exactly one band.
+  const int band_count = (int) ((v_max_ - v_min_) / spacing_) + 1;
+  bands_.resize(band_count);
+  edges_.reserve(rotated.size());
+  for (size_t i = 0; i < rotated.size(); ++i) {
+    const Vector2D &a = rotated[i];
+    const Vector2D &b = rotated[(i + 1) % rotated.size()];
+    if (a.y == b.y)
+      continue;  // Parallel to scan lines, never crossing one.
+    const Edge edge = { a.x, a.y, b.x, b.y };
+    const int edge_index = edges_.size();
+    edges_.push_back(edge);
+    const int from_band = (int) ((std::min(a.y, b.y) - v_min_) / spacing_);
+    const int to_band = (int) ((std::max(a.y, b.y) - v_min_) / spacing_);
+    for (int band = from_band; band <= to_band && band < band_count; ++band)
+      bands_[band].push_back(edge_index);
+  }
+}
+
+void ScanlineIndex::Intersections(double v, std::vector<double> *result) const {
+  const int band = (int) ((v - v_min_) / spacing_);
+  if (band < 0 || band >= (int) bands_.size())
+    return;
+  const size_t first = result->size();
+  for (int edge_index : bands_[band]) {
+    const Edge &e = edges_[edge_index];
+    // Half-open, so that lines through vertices count only once.
+    if ((e.v0 <= v && v < e.v1) || (e.v1 <= v && v < e.v0)) {
+      result->push_back(e.u0 + (v - e.v0) * (e.u1 - e.u0) / (e.v1 - e.v0));
+    }
+  }
+  std::sort(result->begin() + first, result->end());
+}
+
+std::vector<LineSegment> ScanlineIndex::Fill() const {
+  std::vector<LineSegment> result;
+  std::vector<double> crossings;
+  bool forward = true;
+  for (double v = v_min_ + spacing_ / 2; v < v_max_; v += spacing_) {
+    crossings.clear();
+    Intersections(v, &crossings);
+    // Even-odd rule: pairs of crossings are inside.
+    const int pairs = crossings.size() / 2;
+    for (int i = 0; i < pairs; ++i) {
+      const int pair = forward ? i : pairs - 1 - i;
+      double from = crossings[2 * pair];
+      double to = crossings[2 * pair + 1];
+      if (!forward) std::swap(from, to);
+      result.push_back(LineSegment(rotate(Vector2D(from, v), angle_),
+                                   rotate(Vector2D(to, v), angle_)));
+    }
+    forward = !forward;
+  }
+  return result;
+}
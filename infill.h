@@ -0,0 +1,49 @@
+/* -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+ * (c) 2014 Henner Zeller <h.zeller@acm.org>
+ * Creative commons BY-SA
+ */
+#ifndef SHELL_EXTRUDE_INFILL_H_
+#define SHELL_EXTRUDE_INFILL_H_
+
+#include <vector>
+
+#include "multi-shell-extrude.h"
+
+struct LineSegment {
+  LineSegment(const Vector2D &f, const Vector2D &t) : from(f), to(t) {}
+  Vector2D from, to;
+};
+
+// Spatial index of the edges of a polygon, for fast clipping of parallel
+// scan lines at a particular angle. The edges are sorted into bands
+// perpendicular to the scan direction, so for each scan line only the few
+// edges in its band need to be looked at.
+// Can be re-used for all layers that fill at the same angle.
+class ScanlineIndex {
+public:
+  // Index "polygon" for scanlines in direction "angle" (radians), that are
+  // "spacing" apart.
+  ScanlineIndex(const Polygon &polygon, double angle, double spacing);
+
+  // Rectilinear fill: all scan lines clipped to the inside of the polygon.
+  // Ordered back and forth, so that the end of one line is close to the
+  // start of the next.
+  std::vector<LineSegment> Fill() const;
+
+private:
+  // Append sorted positions along the scan line at "v" where it crosses the
+  // polygon edges.
+  void Intersections(double v, std::vector<double> *result) const;
+
+  struct Edge {
+    double u0, v0, u1, v1;   // In the rotated coordinate system.
+  };
+
+  const double angle_;
+  const double spacing_;
+  double v_min_, v_max_;
+  std::vector<Edge> edges_;
+  std::vector<std::vector<int> > bands_;  // Edge indices per band.
+};
+
+#endif  // SHELL_EXTRUDE_INFILL_H_
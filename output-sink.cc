@@ -0,0 +1,164 @@
+/* -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+ * (c) 2014 Henner Zeller <h.zeller@acm.org>
+ * Creative commons BY-SA
+ */
+
+#include "output-sink.h"
+
+#include <errno.h>
+#include <unistd.h>
+#ifdef __linux__
+#  include <sys/sendfile.h>
+#endif
+
+#include <algorithm>
+
+void OutputSink::Printf(const char *fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  VPrintf(fmt, ap);
+  va_end(ap);
+}
+
+void OutputSink::VPrintf(const char *fmt, va_list ap) {
+  // Most of our output are short lines, so usually fits on the stack.
+  char buffer[512];
+  va_list ap_copy;
+  va_copy(ap_copy, ap);
+  const int len = vsnprintf(buffer, sizeof(buffer), fmt, ap_copy);
+  va_end(ap_copy);
+  if (len < 0)
+    return;
+  if (len < (int) sizeof(buffer)) {
+    Write(buffer, len);
+    return;
+  }
+  std::string large(len + 1, '\0');
+  vsnprintf(&large[0], large.size(), fmt, ap);
+  Write(large.data(), len);
+}
+
+bool OutputSink::WriteFromFd(int fd, size_t len) {
+  char buffer[65536];
+  while (len > 0) {
+    const ssize_t r = read(fd, buffer, std::min(len, sizeof(buffer)));
+    if (r < 0 && errno == EINTR)
+      continue;
+    if (r <= 0)
+      return false;
+    Write(buffer, r);
+    len -= r;
+  }
+  return true;
+}
+
+// Copy from "in_fd" to "out_fd" without going through user space. Returns
+// the number of bytes that could not be copied this way.
+static size_t SendFile(int out_fd, int in_fd, size_t len) {
+#ifdef __linux__
+  while (len > 0) {
+    const ssize_t sent = sendfile(out_fd, in_fd, NULL, len);
+    if (sent < 0 && errno == EINTR)
+      continue;
+    if (sent <= 0)
+      break;   // Not supported for this kind of file; or short input.
+    len -= sent;
+  }
+#endif
+  return len;
+}
+
+namespace {
+class BufferSink : public OutputSink {
+public:
+  explicit BufferSink(std::string *buffer) : buffer_(buffer) {}
+
+  virtual void Write(const char *data, size_t len) {
+    buffer_->append(data, len);
+  }
+
+private:
+  std::string *const buffer_;
+};
+
+class FileSink : public OutputSink {
+public:
+  explicit FileSink(FILE *file) : file_(file) {}
+
+  virtual void Write(const char *data, size_t len) {
+    fwrite(data, 1, len, file_);
+  }
+  virtual bool WriteFromFd(int fd, size_t len) {
+    fflush(file_);
+    return OutputSink::WriteFromFd(fd, SendFile(fileno(file_), fd, len));
+  }
+
+private:
+  FILE *const file_;
+};
+
+class FdSink : public OutputSink {
+public:
+  explicit FdSink(int fd) : fd_(fd) {}
+  virtual ~FdSink() { Flush(); }
+
+  virtual void Write(const char *data, size_t len) {
+    buffer_.append(data, len);
+    if (buffer_.size() >= kFlushSize)
+      Flush();
+  }
+  virtual bool WriteFromFd(int fd, size_t len) {
+    Flush();
+    return OutputSink::WriteFromFd(fd, SendFile(fd_, fd, len));
+  }
+
+private:
+  static const size_t kFlushSize = 65536;
+
+  void Flush() {
+    const char *data = buffer_.data();
+    size_t len = buffer_.size();
+    while (len > 0) {
+      const ssize_t written = write(fd_, data, len);
+      if (written < 0) {
+        if (errno == EINTR) continue;
+        break;
+      }
+      data += written;
+      len -= written;
+    }
+    buffer_.clear();
+  }
+
+  const int fd_;
+  std::string buffer_;
+};
+
+class CallbackSink : public OutputSink {
+public:
+  explicit CallbackSink(
+    const std::function<void(const char *data, size_t len)> &callback)
+    : callback_(callback) {}
+
+  virtual void Write(const char *data, size_t len) {
+    callback_(data, len);
+  }
+
+private:
+  const std::function<void(const char *data, size_t len)> callback_;
+};
+}  // end anonymous namespace.
+
+OutputSink *CreateBufferSink(std::string *buffer) {
+  return new BufferSink(buffer);
+}
+OutputSink *CreateFileSink(FILE *file) {
+  return new FileSink(file);
+}
+OutputSink *CreateFdSink(int fd) {
+  return new FdSink(fd);
+}
+OutputSink *CreateCallbackSink(
+  const std::function<void(const char *data, size_t len)> &callback) {
+  return new CallbackSink(callback);
+}
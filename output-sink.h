@@ -0,0 +1,55 @@
+/* -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+ * (c) 2014 Henner Zeller <h.zeller@acm.org>
+ * Creative commons BY-SA
+ */
+#ifndef SHELL_EXTRUDE_OUTPUT_SINK_H_
+#define SHELL_EXTRUDE_OUTPUT_SINK_H_
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include <functional>
+#include <string>
+
+// Define this with empty, if you're not using gcc.
+#ifdef __GNUC__
+#  define PRINTF_FMT_CHECK(fmt_pos, args_pos) \
+      __attribute__ ((format (printf, fmt_pos, args_pos)))
+#else
+#  define PRINTF_FMT_CHECK(fmt_pos, args_pos)
+#endif
+
+// Where generated output goes to. Printers only write through this, so
+// output can end up in a file, a memory buffer or be handed to a callback.
+class OutputSink {
+public:
+  virtual ~OutputSink() {}
+
+  virtual void Write(const char *data, size_t len) = 0;
+
+  // Write "len" bytes read from file descriptor "fd", starting at its
+  // current position. Sinks ending up in a file descriptor copy them
+  // in the kernel. Returns false if not all could be read.
+  virtual bool WriteFromFd(int fd, size_t len);
+
+  void Printf(const char *fmt, ...) PRINTF_FMT_CHECK(2, 3);
+  void VPrintf(const char *fmt, va_list ap);
+};
+
+// Appends to the given string, which needs to outlive the sink.
+OutputSink *CreateBufferSink(std::string *buffer);
+
+// Writes to an open FILE, such as stdout. Not closed by the sink.
+OutputSink *CreateFileSink(FILE *file);
+
+// Writes to an open file descriptor. Not closed by the sink.
+OutputSink *CreateFdSink(int fd);
+
+// Hands each chunk of output to the callback.
+OutputSink *CreateCallbackSink(
+  const std::function<void(const char *data, size_t len)> &callback);
+
+#undef PRINTF_FMT_CHECK
+
+#endif  // SHELL_EXTRUDE_OUTPUT_SINK_H_
@@ -4,101 +4,244 @@
  */
 
 #include "multi-shell-extrude.h"
+#include "fixed-polygon.h"
+#include "scratch-arena.h"
 
-#include <limits.h>
+#include <math.h>
 
 // Offset using the clipper library.
 // http://www.angusj.com/delphi/clipper/documentation/Docs/Units/ClipperLib/Classes/ClipperOffset/_Body.htm
 
-#include "third_party/clipper.hpp"
+using ClipperLib::cInt;
+using ClipperLib::IntPoint;
+
+FixedPolygon ToFixed(const Polygon &polygon) {
+  FixedPolygon result;
+  result.reserve(polygon.size());
+  for (const Vector2D &p : polygon) {
+    result.push_back(IntPoint(llround(p.x * kFixedResolution),
+                              llround(p.y * kFixedResolution)));
+  }
+  return result;
+}
+
+void FromFixed(const FixedPolygon &polygon, Polygon *result) {
+  result->clear();
+  result->reserve(polygon.size());
+  for (const IntPoint &p : polygon) {
+    result->push_back(Vector2D(p.X / kFixedResolution,
+                               p.Y / kFixedResolution));
+  }
+}
+
+Polygon FromFixed(const FixedPolygon &polygon) {
+  Polygon result;
+  FromFixed(polygon, &result);
+  return result;
+}
+
+static IntPoint FixedCentroid(const FixedPolygon &polygon) {
+  cInt x = 0, y = 0;
+  for (const IntPoint &p : polygon) {
+    x += p.X;
+    y += p.Y;
+  }
+  const cInt n = polygon.size();
+  return IntPoint(x / n, y / n);
+}
 
 // A path is centered if the rectangle aorund it is covering the centroid.
-static bool is_centered(const Vector2D &centroid, const ClipperLib::Path &path) {
-  int min_x = INT_MAX, min_y = INT_MAX;
-  int max_x = INT_MIN, max_y = INT_MIN;
-  for (const ClipperLib::IntPoint &p : path) {
+static bool is_centered(const IntPoint &centroid, const FixedPolygon &path) {
+  cInt min_x = path[0].X, max_x = path[0].X;
+  cInt min_y = path[0].Y, max_y = path[0].Y;
+  for (const IntPoint &p : path) {
     if (p.X < min_x) min_x = p.X;
     if (p.X > max_x) max_x = p.X;
     if (p.Y < min_y) min_y = p.Y;
     if (p.Y > max_y) max_y = p.Y;
   }
-  return (min_x < centroid.x && max_x > centroid.x
-          && min_y < centroid.y && max_y > centroid.y);
+  return (min_x < centroid.X && max_x > centroid.X
+          && min_y < centroid.Y && max_y > centroid.Y);
 }
 
-Polygon PolygonOffset(const Polygon &polygon, double offset,
-                      OffsetType type) {
-  // Converting float to clipper integer values. Make sure
-  // to stay within limits.
-  const float kResolution = 1e4;
-  const float kAccuracy = 0.01; // mm : cutting corners with this accuracy
+// The way the clipper library works, the offset polygon might start at a
+// different point - after all, it is a different polygon.
+// Let's rotate it to start with the point closest to "reference", which
+// is the start of the input polygon. All in integers, so the choice is
+// deterministic.
+static FixedPolygon AlignStart(const FixedPolygon &polygon,
+                               const IntPoint &reference) {
+  cInt smallest = -1;
+  std::size_t offset_index = 0;
+  for (std::size_t i = 0; i < polygon.size(); ++i) {
+    const cInt dx = polygon[i].X - reference.X;
+    const cInt dy = polygon[i].Y - reference.Y;
+    const cInt dist_sq = dx * dx + dy * dy;
+    if (i == 0 || dist_sq < smallest) {
+      offset_index = i;
+      smallest = dist_sq;
+    }
+  }
 
-  ClipperLib::Path path;
-  Vector2D centroid;
-  for (const Vector2D &p : polygon) {
-    Vector2D clipper_point = p * kResolution;
-    path.push_back(ClipperLib::IntPoint(clipper_point.x, clipper_point.y));
-    centroid = centroid + clipper_point;
+  // .. then create the result by shifting that.
+  FixedPolygon result;
+  result.reserve(polygon.size());
+  for (std::size_t i = 0; i < polygon.size(); ++i) {
+    result.push_back(polygon[(i + offset_index) % polygon.size()]);
   }
-  centroid = centroid / polygon.size();
+  return result;
+}
 
-  ClipperLib::Paths solutions;
-  ClipperLib::ClipperOffset co(2.0, kAccuracy * kResolution);
+// From the offset "solutions", pick the piece that is centered around the
+// "centroid" of the original polygon and rotate it to start closest to
+// "reference".
+static FixedPolygon SelectCenteredAndAlign(const ClipperLib::Paths &solutions,
+                                           const IntPoint &centroid,
+                                           const IntPoint &reference) {
+  if (solutions.size() == 0)  // Nothing left.
+    return FixedPolygon();
+
+  // A polygon might become pieces when offset. Use the one that is centered.
+  const FixedPolygon *centered_polygon = &solutions[0];
+  for (const FixedPolygon &solution : solutions) {
+    if (is_centered(centroid, solution)) {
+      centered_polygon = &solution;
+      break;
+    }
+  }
+  return AlignStart(*centered_polygon, reference);
+}
+
+std::vector<FixedPolygon> FixedPolygonOffsets(const FixedPolygon &polygon,
+                                              const std::vector<double> &offsets,
+                                              OffsetType type) {
+  std::vector<FixedPolygon> result(offsets.size());
+  if (polygon.empty())
+    return result;
+
+  // Clipper creates a lot of short-lived small allocations. Serve them
+  // from the scratch arena (if the program routes operator new there, see
+  // scratch-arena.h); only our results are allocated on the heap.
+  ScratchArena::Scope arena_scope;
+
+  const double kAccuracy = 0.01; // mm : cutting corners with this accuracy
+
+  ClipperLib::ClipperOffset co(2.0, kAccuracy * kFixedResolution);
   ClipperLib::JoinType join = ClipperLib::jtRound;
   switch (type) {
   case kOffsetRound:  join = ClipperLib::jtRound; break;
   case kOffsetSquare: join = ClipperLib::jtSquare; break;
   case kOffsetMiter:  join = ClipperLib::jtMiter; break;
   }
-  co.AddPath(path, join, ClipperLib::etClosedPolygon);
-  co.Execute(solutions, kResolution * offset);
+  // Path cleaning and orientation are done once here and re-used for
+  // each of the offsets; Execute() still offsets from scratch every time.
+  co.AddPath(polygon, join, ClipperLib::etClosedPolygon);
 
-  if (solutions.size() == 0)  // Nothing left.
-    return Polygon();
+  const IntPoint centroid = FixedCentroid(polygon);
+  ClipperLib::Paths solutions;  // Re-used for all offsets.
+  for (size_t i = 0; i < offsets.size(); ++i) {
+    co.Execute(solutions, kFixedResolution * offsets[i]);
+    ScratchArena::Suspend use_heap;
+    result[i] = SelectCenteredAndAlign(solutions, centroid, polygon[0]);
+  }
+  return result;
+}
 
-  // A polygon might become pieces when offset. Use the one that is centered.
-  ClipperLib::Path &centered_polygon = solutions[0];
-  for (const ClipperLib::Path &solution : solutions) {
-    if (is_centered(centroid, solution)) {
-      centered_polygon = solution;
-      break;
-    }
+FixedPolygon FixedPolygonOffset(const FixedPolygon &polygon, double offset,
+                                OffsetType type) {
+  return FixedPolygonOffsets(polygon, std::vector<double>(1, offset), type)[0];
+}
+
+std::vector<FixedPolygons> FixedIslands(const FixedPolygons &contours) {
+  std::vector<FixedPolygons> result;
+  if (contours.size() <= 1) {
+    if (!contours.empty()) result.push_back(contours);
+    return result;
+  }
+  // Even-odd: it doesn't matter in which direction contours go.
+  ClipperLib::Clipper clipper;
+  clipper.AddPaths(contours, ClipperLib::ptSubject, true);
+  ClipperLib::PolyTree tree;
+  clipper.Execute(ClipperLib::ctUnion, tree,
+                  ClipperLib::pftEvenOdd, ClipperLib::pftEvenOdd);
+  for (ClipperLib::PolyNode *node = tree.GetFirst(); node != NULL;
+       node = node->GetNext()) {
+    if (node->IsHole())
+      continue;
+    FixedPolygons island(1, node->Contour);
+    for (const ClipperLib::PolyNode *hole : node->Childs)
+      island.push_back(hole->Contour);
+    result.push_back(island);
   }
+  return result;
+}
 
-  Polygon tmp;
-  for (const ClipperLib::IntPoint &p : centered_polygon) {
-    tmp.push_back(Vector2D(p.X / kResolution, p.Y / kResolution));
+std::vector<FixedPolygons> FixedRegionOffsets(const FixedPolygons &region,
+                                              const std::vector<double> &offsets,
+                                              OffsetType type) {
+  std::vector<FixedPolygons> result(offsets.size());
+  if (region.empty() || region[0].empty())
+    return result;
+
+  ScratchArena::Scope arena_scope;   // See FixedPolygonOffsets()
+
+  const double kAccuracy = 0.01; // mm : cutting corners with this accuracy
+  ClipperLib::ClipperOffset co(2.0, kAccuracy * kFixedResolution);
+  ClipperLib::JoinType join = ClipperLib::jtRound;
+  switch (type) {
+  case kOffsetRound:  join = ClipperLib::jtRound; break;
+  case kOffsetSquare: join = ClipperLib::jtSquare; break;
+  case kOffsetMiter:  join = ClipperLib::jtMiter; break;
   }
+  co.AddPaths(region, join, ClipperLib::etClosedPolygon);
 
-  // The way the clipper library works, the offset polygon might start at a
-  // different point - after all, it is a different polygon.
-  // Let's try to find the one that is closest to the start of the input polygon
-  // by looking for the closest point to the line represented by the start-vector,
-  // i.e. closest point in the same direction.
-  const Vector2D &reference = polygon[0];
-  double smallest = -1;
-  std::size_t offset_index = 0;
-  for (std::size_t i = 0; i < tmp.size(); ++i) {
-    const Vector2D &p = tmp[i];
-#if 0
-    // TODO: find center and make line relative to that.
-    // Then use http://en.wikipedia.org/wiki/Distance_from_a_point_to_a_line#Line_defined_by_two_points
-    const double dist = abs(reference.y * p.x - reference.x * p.y);
-    const bool same_side = (reference.x * p.x >= 0) && (reference.y * p.y >= 0);
-#else
-    const double dist = distance(p.x - reference.x, p.y - reference.y, 0);
-    const bool same_side = true;
-#endif
-    if (i == 0 || (dist < smallest && same_side)) {
-      offset_index = i;
-      smallest = dist;
+  // Outlines are oriented positive, holes negative. (The PolyTree variant
+  // of the offset doesn't set up the hole information correctly for
+  // negative offsets).
+  ClipperLib::Paths solutions;
+  for (size_t i = 0; i < offsets.size(); ++i) {
+    co.Execute(solutions, kFixedResolution * offsets[i]);
+    ScratchArena::Suspend use_heap;
+    for (const FixedPolygon &solution : solutions) {
+      if (ClipperLib::Orientation(solution))
+        result[i].push_back(AlignStart(solution, region[0][0]));
     }
   }
+  return result;
+}
 
-  // .. then create the result by shifting that.
-  Polygon result;
-  for (std::size_t i = 0; i < tmp.size(); ++i) {
-    result.push_back(tmp[(i + offset_index) % tmp.size()]);
+std::vector<FixedPolygon> FixedConcentricRings(const FixedPolygon &polygon,
+                                               const std::vector<double> &offsets) {
+  std::vector<FixedPolygon> result(offsets.size());
+  size_t first_inside = 0;
+  while (first_inside < offsets.size() && offsets[first_inside] >= 0)
+    ++first_inside;
+
+  // Outside rings: growing outwards, starting with the one closest to the
+  // polygon.
+  const FixedPolygon *previous = &polygon;
+  double previous_offset = 0;
+  for (size_t i = first_inside; i-- > 0; /**/) {
+    const double delta = offsets[i] - previous_offset;
+    result[i] = (delta == 0) ? *previous : FixedPolygonOffset(*previous, delta);
+    previous = &result[i];
+    previous_offset = offsets[i];
+  }
+
+  // Inside rings: shrinking inwards until nothing is left.
+  previous = &polygon;
+  previous_offset = 0;
+  for (size_t i = first_inside; i < offsets.size(); ++i) {
+    result[i] = FixedPolygonOffset(*previous, offsets[i] - previous_offset);
+    if (result[i].empty())
+      break;
+    previous = &result[i];
+    previous_offset = offsets[i];
   }
   return result;
 }
+
+Polygon PolygonOffset(const Polygon &polygon, double offset,
+                      OffsetType type) {
+  return FromFixed(FixedPolygonOffset(ToFixed(polygon), offset, type));
+}
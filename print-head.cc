@@ -0,0 +1,150 @@
+/* -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+ * (c) 2014 Henner Zeller <h.zeller@acm.org>
+ * Creative commons BY-SA
+ */
+
+#include "print-head.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+#include <algorithm>
+
+// Distance kept between parts, and between parts and the head.
+static const double kPartSpacing = 1.0;
+
+// Resolution in which positions are tried when placing parts.
+static const double kPlacementStep = 0.5;
+
+PrintHead::PrintHead(const Polygon &footprint, double gantry_height)
+  : footprint_(footprint), gantry_height_(gantry_height),
+    footprint_min_(0, 0), footprint_max_(0, 0) {
+  for (const Vector2D &p : footprint_) {
+    footprint_min_.x = std::min(footprint_min_.x, p.x);
+    footprint_min_.y = std::min(footprint_min_.y, p.y);
+    footprint_max_.x = std::max(footprint_max_.x, p.x);
+    footprint_max_.y = std::max(footprint_max_.y, p.y);
+  }
+}
+
+bool PrintHead::ParseFootprint(const std::string &spec, Polygon *footprint) {
+  std::vector<double> values;
+  const char *s = spec.c_str();
+  while (*s) {
+    char *end;
+    values.push_back(strtod(s, &end));
+    if (end == s)
+      return false;
+    s = end;
+    if (*s == ',')
+      ++s;
+    else if (*s != '\0')
+      return false;
+  }
+  if (values.size() % 2 != 0 || values.size() < 6)
+    return false;
+  footprint->clear();
+  for (size_t i = 0; i < values.size(); i += 2)
+    footprint->push_back(Vector2D(values[i], values[i+1]));
+  return true;
+}
+
+double PrintHead::FootprintDistance(const Vector2D &p) const {
+  bool inside = false;
+  double result = HUGE_VAL;
+  for (size_t i = 0; i < footprint_.size(); ++i) {
+    const Vector2D &a = footprint_[i];
+    const Vector2D &b = footprint_[(i + 1) % footprint_.size()];
+    if ((a.y > p.y) != (b.y > p.y)
+        && p.x < a.x + (p.y - a.y) * (b.x - a.x) / (b.y - a.y)) {
+      inside = !inside;
+    }
+    const Vector2D d = b - a;
+    const double len2 = d.x * d.x + d.y * d.y;
+    double t = 0;
+    if (len2 > 0) {
+      t = ((p.x - a.x) * d.x + (p.y - a.y) * d.y) / len2;
+      t = std::max(0.0, std::min(1.0, t));
+    }
+    result = std::min(result, distance(p.x - (a.x + t * d.x),
+                                       p.y - (a.y + t * d.y), 0));
+  }
+  return inside ? 0 : result;
+}
+
+bool PrintHead::Collides(const PlacedPart &part, bool gantry_in_way,
+                         const PlacedPart &other) const {
+  const Vector2D d = other.center - part.center;
+  const double min_distance = other.radius + part.radius + kPartSpacing;
+  if (gantry_in_way
+      && d.y + min_distance > footprint_min_.y
+      && d.y - min_distance < footprint_max_.y)
+    return true;
+  if (d.x * d.x + d.y * d.y < min_distance * min_distance)
+    return true;
+  // The nozzle moves within the part, so the head covers the footprint
+  // grown by the part radius.
+  if (d.x + min_distance <= footprint_min_.x
+      || d.x - min_distance >= footprint_max_.x
+      || d.y + min_distance <= footprint_min_.y
+      || d.y - min_distance >= footprint_max_.y)
+    return false;
+  return FootprintDistance(d) < min_distance;
+}
+
+bool PrintHead::CanPrint(const PlacedPart &part, double height,
+                         const std::vector<PlacedPart> &printed,
+                         int *blocker) const {
+  const bool gantry_in_way = (gantry_height_ > 0 && height > gantry_height_);
+  const int first = (blocker && *blocker >= 0
+                     && *blocker < (int) printed.size()) ? *blocker : -1;
+  if (first >= 0 && Collides(part, gantry_in_way, printed[first]))
+    return false;
+  for (size_t i = 0; i < printed.size(); ++i) {
+    if ((int) i != first && Collides(part, gantry_in_way, printed[i])) {
+      if (blocker) *blocker = i;
+      return false;
+    }
+  }
+  return true;
+}
+
+int PlaceParts(const PrintHead &head, double height,
+               const std::vector<double> &radii,
+               const Vector2D &bed_min, const Vector2D &bed_max,
+               std::vector<Vector2D> *positions) {
+  std::vector<PlacedPart> placed;
+  for (const double radius : radii) {
+    const Vector2D low = bed_min + Vector2D(radius, radius);
+    const Vector2D high = bed_max - Vector2D(radius, radius);
+    if (high.x < low.x || high.y < low.y)
+      break;
+    const int nx = (int) ((high.x - low.x) / kPlacementStep);
+    const int ny = (int) ((high.y - low.y) / kPlacementStep);
+    // Diagonals of increasing distance from bed_min; along each, starting
+    // in the middle.
+    bool found = false;
+    int blocker = -1;
+    for (int diagonal = 0; diagonal <= nx + ny && !found; ++diagonal) {
+      const int x_from = std::max(0, diagonal - ny);
+      const int x_to = std::min(diagonal, nx);
+      const int middle = (x_from + x_to) / 2;
+      for (int i = 0; i <= 2 * (x_to - x_from) && !found; ++i) {
+        const int x = (i % 2 == 0) ? middle + i / 2 : middle - (i + 1) / 2;
+        if (x < x_from || x > x_to)
+          continue;
+        const Vector2D center(low.x + x * kPlacementStep,
+                              low.y + (diagonal - x) * kPlacementStep);
+        const PlacedPart part(center, radius);
+        if (head.CanPrint(part, height, placed, &blocker)) {
+          placed.push_back(part);
+          found = true;
+        }
+      }
+    }
+    if (!found)
+      break;
+    positions->push_back(placed.back().center);
+  }
+  return placed.size();
+}
@@ -0,0 +1,71 @@
+/* -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+ * (c) 2014 Henner Zeller <h.zeller@acm.org>
+ * Creative commons BY-SA
+ */
+#ifndef SHELL_EXTRUDE_PRINT_HEAD_H_
+#define SHELL_EXTRUDE_PRINT_HEAD_H_
+
+#include <string>
+#include <vector>
+
+#include "multi-shell-extrude.h"
+
+// A part on the bed as seen by the print head: it rotates while printed, so
+// it is the circle it sweeps, including the brim.
+struct PlacedPart {
+  PlacedPart(const Vector2D &c, double r) : center(c), radius(r) {}
+  Vector2D center;
+  double radius;
+};
+
+// What of the printer gets in the way when printing parts one after the
+// other: the outline of the head around the nozzle, which reaches down to
+// the nozzle tip, and the gantry. The gantry spans the whole bed in X and
+// the Y range of the head; its lowest point is "gantry_height" above the
+// nozzle tip.
+//
+// Between parts, the head travels above all of them (see
+// GenerateUncached()), so only the head coming down to print a part can
+// hit the parts printed before.
+class PrintHead {
+public:
+  // "footprint" is relative to the nozzle at (0,0). A "gantry_height" of 0
+  // means that the gantry is never in the way.
+  PrintHead(const Polygon &footprint, double gantry_height);
+
+  // Parse footprint given as comma separated x,y pairs. Returns false if it
+  // is not a polygon.
+  static bool ParseFootprint(const std::string &spec, Polygon *footprint);
+
+  // Can "part" be printed up to "height" without touching any of the
+  // "printed" parts, which are of the same height?
+  // If "blocker" is non-NULL, it is the index of the part to check first
+  // (or -1) and receives the part in the way. Neighboring positions are
+  // mostly blocked by the same part, so trying many is fast that way.
+  bool CanPrint(const PlacedPart &part, double height,
+                const std::vector<PlacedPart> &printed,
+                int *blocker = NULL) const;
+
+private:
+  bool Collides(const PlacedPart &part, bool gantry_in_way,
+                const PlacedPart &other) const;
+
+  // Distance of "p" to the footprint; 0 if inside.
+  double FootprintDistance(const Vector2D &p) const;
+
+  const Polygon footprint_;
+  const double gantry_height_;
+  Vector2D footprint_min_, footprint_max_;
+};
+
+// Place parts of the given radii on the bed within "bed_min" and "bed_max",
+// in the order they are printed. Each part goes to the position closest to
+// "bed_min" (along the diagonal) where it fits and can be printed without
+// the head touching the parts before it. Appends the centers to
+// "positions"; returns the number of parts that fit.
+int PlaceParts(const PrintHead &head, double height,
+               const std::vector<double> &radii,
+               const Vector2D &bed_min, const Vector2D &bed_max,
+               std::vector<Vector2D> *positions);
+
+#endif  // SHELL_EXTRUDE_PRINT_HEAD_H_
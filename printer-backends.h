@@ -0,0 +1,394 @@
+/* -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+ * (c) 2014 Henner Zeller <h.zeller@acm.org>
+ * Creative commons BY-SA
+ */
+#ifndef SHELL_EXTRUDE_PRINTER_BACKENDS_H_
+#define SHELL_EXTRUDE_PRINTER_BACKENDS_H_
+
+// The concrete printers behind the Create*Printer() functions in printer.h.
+//
+// Toolpath generation that is templated on one of these types calls them
+// directly, so that the calls per vertex (MoveTo(), ExtrudeTo(),
+// SetSpeed()) are inlined; everything else can go through the Printer
+// interface.
+
+#include <string>
+#include <vector>
+
+#include "multi-shell-extrude.h"
+#include "output-sink.h"
+#include "printer.h"
+
+// Define this with empty, if you're not using gcc.
+#ifdef __GNUC__
+#  define PRINTF_FMT_CHECK(fmt_pos, args_pos) \
+      __attribute__ ((format (printf, fmt_pos, args_pos)))
+#else
+#  define PRINTF_FMT_CHECK(fmt_pos, args_pos)
+#endif
+
+class BinaryGCodeSink;
+
+class GCodePrinter final : public Printer {
+public:
+  GCodePrinter(OutputSink *out, const GCodeDialect *dialect,
+               double extrusion_factor,
+               const std::vector<ToolSettings> &tools, double bed_temp,
+               GCodeEncoding encoding);
+  virtual ~GCodePrinter();
+
+  virtual void Preamble(const Vector2D &machine_limit,
+                        double feed_mm_per_sec);
+  virtual void Init(const Vector2D &machine_limit, double feed_mm_per_sec);
+  virtual void Postamble();
+  virtual void Comment(const char *fmt, ...);
+  virtual void SetTemperature(double temperature);
+  virtual void SetSpeed(double feed_mm_per_sec) {
+    if (feed_mm_per_sec != current_feedrate_) {
+      if (out_) out_->Printf("G1 F%.1f  ; feedrate=%.1fmm/s\n",
+                             feed_mm_per_sec * 60, feed_mm_per_sec);
+      current_feedrate_ = feed_mm_per_sec;
+    }
+  }
+  virtual void ResetExtrude();
+  virtual void Retract();
+  virtual void GoZPos(double z) {
+    out_->Printf("G1 Z%.3f\n", z);
+  }
+  virtual void MoveTo(const Vector2D &pos, double z) {
+    if (out_) out_->Printf("G1 X%.3f Y%.3f Z%.3f\n", pos.x, pos.y, z);
+    last_x_ = pos.x; last_y_ = pos.y; last_z_ = z;
+  }
+  virtual void ExtrudeTo(const Vector2D &pos, double z,
+                         double extrusion_multiplier) {
+    const double segment = distance(pos.x - last_x_, pos.y - last_y_,
+                                    z - last_z_);
+    extrude_dist_ += segment;
+    // The multiplier only applies to this segment; it changes with the
+    // layer (first layers, layer height).
+    const double e_per_mm = filament_extrusion_factor_ * extrusion_multiplier;
+    extruded_ += segment * e_per_mm;
+    // Filament is pushed at filament_speed; with software pressure advance,
+    // we keep the filament ahead by K * filament_speed. Feedrate changes
+    // thus result in a corresponding step in E.
+    const double advance = software_advance_ * current_feedrate_ * e_per_mm;
+    if (out_) out_->Printf("G1 X%.3f Y%.3f Z%.3f E%.3f\n", pos.x, pos.y, z,
+                           extruded_ + advance);
+    last_x_ = pos.x; last_y_ = pos.y; last_z_ = z;
+  }
+  virtual void SwitchFan(bool on);
+  virtual double GetExtrusionDistance() { return extrude_dist_; }
+  virtual void Extrude(const Polygon &polygon, const Vector2D &center,
+                       const ExtrusionParams &params);
+  virtual void SelectTool(int tool);
+  virtual void SetToolTemperature(int tool, double temperature);
+  virtual void SetMotionLimits(double velocity, double accel);
+  virtual void AddThumbnail(const RasterImage &image);
+  virtual void SetTotals(double print_seconds, double filament_mm);
+  virtual void SetProgress(double fraction, double remaining_seconds);
+  virtual void SetPressureAdvance(double k, bool in_firmware);
+
+  // A printer that continues from the current state of this one, such as
+  // position, E and feedrate, but writes GCode text to "out" instead. If
+  // "out" is NULL, the fork only follows the state of the calls made to it
+  // (those in the extrusion loop), which is much cheaper than formatting.
+  GCodePrinter *Fork(OutputSink *out) const;
+
+  // Continue from the state "fork" is in now.
+  void ContinueFrom(const GCodePrinter &fork);
+
+  // Write GCode text that a fork created.
+  void Append(const std::string &gcode) {
+    out_->Write(gcode.data(), gcode.size());
+  }
+
+private:
+  GCodePrinter(const GCodePrinter &other, OutputSink *out);
+
+  // Totals as comment lines.
+  std::string TotalsText(const char *time_str, const char *filament_str);
+
+  BinaryGCodeSink *const bgcode_;   // Encoders; NULL if writing text.
+  OutputSink *const meatpack_;
+  OutputSink *const out_;           // Where GCode text goes.
+  const GCodeDialect *const dialect_;
+  const double filament_extrusion_factor_;
+  const std::vector<ToolSettings> tools_;
+  int current_tool_;
+  double current_feedrate_;
+  double temperature_;   // of current tool.
+  double bed_temp_;
+  double last_x_, last_y_, last_z_;
+  double extrude_dist_;
+  double extruded_;           // E position, without advance.
+  double software_advance_;   // K in seconds, 0 if not done by us.
+  int progress_percent_;      // Last sent; -1 if none yet.
+  int progress_minutes_;
+  std::vector<bool> in_retract_;  // per tool.
+};
+
+// Takes the calls of the extrusion loop of a shell in place of a
+// GCodePrinter, and formats them in parallel: the calls are recorded in
+// parts, each of which is formatted by a fork of the printer in its own
+// thread. The state each part starts with, foremost the E position, is
+// followed in the order of the calls by a fork that does not write; so the
+// output is the same as from the printer itself.
+class ParallelGCodeWriter {
+public:
+  ParallelGCodeWriter(GCodePrinter *printer, int threads);
+  // Writes what is left; the printer continues where we ended.
+  ~ParallelGCodeWriter();
+
+  void Comment(const char *fmt, ...) PRINTF_FMT_CHECK(2, 3);
+  void SetColor(float r, float g, float b) {}
+  void SwitchFan(bool on) { Add(Op(Op::FAN, on)); tracker_->SwitchFan(on); }
+  void SetTemperature(double t) {
+    Add(Op(Op::TEMPERATURE, 0, t));
+    tracker_->SetTemperature(t);
+  }
+  void SetToolTemperature(int tool, double t) {
+    Add(Op(Op::TOOL_TEMPERATURE, tool, t));
+    tracker_->SetToolTemperature(tool, t);
+  }
+  void SetProgress(double fraction, double remaining_seconds) {
+    Add(Op(Op::PROGRESS, 0, fraction, remaining_seconds));
+    tracker_->SetProgress(fraction, remaining_seconds);
+  }
+  void SetSpeed(double feed_mm_per_sec) {
+    Add(Op(Op::SPEED, 0, feed_mm_per_sec));
+    tracker_->SetSpeed(feed_mm_per_sec);
+  }
+  void MoveTo(const Vector2D &pos, double z) {
+    Add(Op(Op::MOVE, 0, z, 0, pos));
+    tracker_->MoveTo(pos, z);
+  }
+  void ExtrudeTo(const Vector2D &pos, double z, double extrusion_multiplier) {
+    Add(Op(Op::EXTRUDE, 0, z, extrusion_multiplier, pos));
+    tracker_->ExtrudeTo(pos, z, extrusion_multiplier);
+  }
+  double GetExtrusionDistance() { return tracker_->GetExtrusionDistance(); }
+
+private:
+  struct Op {
+    enum Kind {
+      MOVE, EXTRUDE, SPEED, TEMPERATURE, TOOL_TEMPERATURE, PROGRESS, FAN,
+      COMMENT
+    };
+    Op(Kind k, int i, double a = 0, double b = 0,
+       const Vector2D &p = Vector2D())
+      : kind(k), index(i), pos(p), value(a), value2(b) {}
+    Kind kind;
+    int index;       // Tool, fan on, or comment.
+    Vector2D pos;
+    double value;    // z, speed, temperature or progress fraction.
+    double value2;   // Extrusion multiplier or remaining seconds.
+  };
+  struct Part {
+    size_t first_op;
+    std::string *gcode;
+    OutputSink *sink;
+    GCodePrinter *printer;   // Starts with the state at first_op.
+  };
+
+  void Add(const Op &op);
+  void Format(const Part &part, size_t end_op);
+  void Flush();
+
+  GCodePrinter *const printer_;
+  const size_t threads_;
+  GCodePrinter *const tracker_;   // Follows all calls, without output.
+  std::vector<Op> ops_;
+  std::vector<std::string> comments_;
+  std::vector<Part> parts_;
+};
+
+class PostScriptPrinter final : public Printer {
+public:
+  PostScriptPrinter(OutputSink *out, bool show_move_as_line,
+                    double line_thickness);
+
+  virtual void Preamble(const Vector2D &machine_limit,
+                        double feed_mm_per_sec);
+  virtual void Init(const Vector2D &machine_limit, double feed_mm_per_sec);
+  virtual void Postamble();
+  virtual void Comment(const char *fmt, ...);
+  virtual void SetSpeed(double feed_mm_per_sec) {}
+  virtual void SetTemperature(double t) {}
+  virtual void ResetExtrude();
+  virtual void Retract() {}
+  virtual void GoZPos(double z) {}
+  virtual void MoveTo(const Vector2D &pos, double z) {
+    if (show_move_as_line_) {
+      if (!in_move_color_) {
+        ColorSwitch(0, 0, 0, 0.9);  // blue move color
+        in_move_color_ = true;
+      }
+      out_->Printf("%.3f %.3f lineto\n", pos.x, pos.y);
+    } else {
+      out_->Printf("%.3f %.3f moveto\n", pos.x, pos.y);
+    }
+  }
+  virtual void ExtrudeTo(const Vector2D &pos, double /*z*/,
+                         double /*extrusion_multiplier*/) {
+    if (in_move_color_) {
+      ColorSwitch(line_thickness_, r_, g_, b_);
+      in_move_color_ = false;
+    }
+    out_->Printf("%.3f %.3f extrude-to\n", pos.x, pos.y);
+  }
+  virtual void SwitchFan(bool on) {}
+  virtual double GetExtrusionDistance() { return 0; }
+  virtual void Extrude(const Polygon &polygon, const Vector2D &center,
+                       const ExtrusionParams &params);
+  virtual void SetColor(float r, float g, float b);
+
+private:
+  void ColorSwitch(float line_width, float r, float g, float b);
+
+  OutputSink *const out_;
+  const bool show_move_as_line_;
+  const float line_thickness_;
+  bool in_move_color_;
+  float r_, g_, b_;   // color.
+};
+
+class SVGPrinter final : public Printer {
+public:
+  SVGPrinter(OutputSink *out, bool show_move_as_line, double line_thickness);
+
+  virtual void Preamble(const Vector2D &machine_limit,
+                        double feed_mm_per_sec);
+  virtual void Init(const Vector2D &machine_limit,
+                    double feed_mm_per_sec) {}
+  virtual void Postamble();
+  virtual void Comment(const char *fmt, ...);
+  virtual void SetSpeed(double feed_mm_per_sec) {}
+  virtual void SetTemperature(double t) {}
+  virtual void ResetExtrude() {}
+  virtual void Retract() {}
+  virtual void GoZPos(double z) {}
+  virtual void MoveTo(const Vector2D &pos, double z);
+  virtual void ExtrudeTo(const Vector2D &pos, double /*z*/,
+                         double /*extrusion_multiplier*/) {
+    if (!in_polyline_)
+      StartPolyline();
+    out_->Printf(" %.3f,%.3f", pos.x, pos.y);
+    last_x_ = pos.x; last_y_ = pos.y;
+  }
+  virtual void SwitchFan(bool on) {}
+  virtual double GetExtrusionDistance() { return 0; }
+  virtual void Extrude(const Polygon &polygon, const Vector2D &center,
+                       const ExtrusionParams &params);
+  virtual void SetColor(float r, float g, float b);
+
+private:
+  void StartPolyline();
+  void EndPolyline();
+
+  OutputSink *const out_;
+  const bool show_move_as_line_;
+  const float line_thickness_;
+  bool in_polyline_;
+  double last_x_, last_y_;
+  float r_, g_, b_;   // color.
+};
+
+// Renders directly into a raster image, which is written as PNG at the end.
+class PNGPrinter final : public Printer {
+public:
+  PNGPrinter(OutputSink *out, PreviewView view, bool show_move_as_line,
+             double line_thickness, double pixel_per_mm, double max_z);
+  virtual ~PNGPrinter();
+
+  virtual void Preamble(const Vector2D &machine_limit,
+                        double feed_mm_per_sec);
+  virtual void Init(const Vector2D &machine_limit,
+                    double feed_mm_per_sec) {}
+  virtual void Postamble();
+  virtual void Comment(const char *fmt, ...) {}
+  virtual void SetSpeed(double feed_mm_per_sec) {}
+  virtual void SetTemperature(double t) {}
+  virtual void ResetExtrude() {}
+  virtual void Retract() {}
+  virtual void GoZPos(double z) { last_z_ = z; }
+  virtual void MoveTo(const Vector2D &pos, double z) {
+    if (show_move_as_line_) {
+      DrawTo(pos, z, 0.1, 0, 0, 0.9);
+    }
+    last_x_ = pos.x; last_y_ = pos.y; last_z_ = z;
+  }
+  virtual void ExtrudeTo(const Vector2D &pos, double z,
+                         double /*extrusion_multiplier*/) {
+    DrawTo(pos, z, line_thickness_, r_, g_, b_);
+    last_x_ = pos.x; last_y_ = pos.y; last_z_ = z;
+  }
+  virtual void SwitchFan(bool on) {}
+  virtual double GetExtrusionDistance() { return 0; }
+  virtual void Extrude(const Polygon &polygon, const Vector2D &center,
+                       const ExtrusionParams &params);
+  virtual void SetColor(float r, float g, float b) {
+    r_ = r; g_ = g; b_ = b;
+  }
+
+private:
+  void DrawTo(const Vector2D &pos, double z, double width_mm,
+              float r, float g, float b);
+
+  OutputSink *const out_;
+  const PreviewView view_;
+  const bool show_move_as_line_;
+  const double line_thickness_;
+  const double pixel_per_mm_;
+  const double max_z_;
+  RasterImage *image_;
+  double last_x_, last_y_, last_z_;
+  float r_, g_, b_;   // color.
+};
+
+// Writes nothing, only counts. Measures how fast the toolpaths themselves
+// are generated.
+class CountingPrinter final : public Printer {
+public:
+  explicit CountingPrinter(PrinterCounts *counts)
+    : counts_(counts), last_x_(0), last_y_(0), last_z_(0), extrude_dist_(0) {
+    *counts_ = PrinterCounts();
+  }
+
+  virtual void Preamble(const Vector2D &machine_limit,
+                        double feed_mm_per_sec) {}
+  virtual void Init(const Vector2D &machine_limit,
+                    double feed_mm_per_sec) {}
+  virtual void Postamble() {}
+  virtual void Comment(const char *fmt, ...) {}
+  virtual void SetSpeed(double feed_mm_per_sec) { ++counts_->speed_changes; }
+  virtual void SetTemperature(double t) {}
+  virtual void ResetExtrude() { extrude_dist_ = 0; }
+  virtual void Retract() {}
+  virtual void GoZPos(double z) { last_z_ = z; }
+  virtual void MoveTo(const Vector2D &pos, double z) {
+    ++counts_->moves;
+    last_x_ = pos.x; last_y_ = pos.y; last_z_ = z;
+  }
+  virtual void ExtrudeTo(const Vector2D &pos, double z,
+                         double extrusion_multiplier) {
+    ++counts_->extrusions;
+    const double segment = distance(pos.x - last_x_, pos.y - last_y_,
+                                    z - last_z_);
+    extrude_dist_ += segment;
+    counts_->extrusion_mm += segment;
+    last_x_ = pos.x; last_y_ = pos.y; last_z_ = z;
+  }
+  virtual void SwitchFan(bool on) {}
+  virtual double GetExtrusionDistance() { return extrude_dist_; }
+  virtual void Extrude(const Polygon &polygon, const Vector2D &center,
+                       const ExtrusionParams &params);
+
+private:
+  PrinterCounts *const counts_;
+  double last_x_, last_y_, last_z_;
+  double extrude_dist_;
+};
+
+#undef PRINTF_FMT_CHECK
+
+#endif  // SHELL_EXTRUDE_PRINTER_BACKENDS_H_
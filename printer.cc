@@ -8,231 +8,590 @@
 #include <stdio.h>
 #include <stdarg.h>
 #include <assert.h>
+#include <math.h>
+#include <stdint.h>
 
+#include <algorithm>
+#include <string>
+#include <thread>
+
+#include "extrusion.h"
+#include "gcode-dialect.h"
+#include "gcode-encoding.h"
 #include "multi-shell-extrude.h"  // for distance()
+#include "output-sink.h"
+#include "printer-backends.h"
+#include "raster-image.h"
 
-namespace {
-class GCodePrinter : public Printer {
-public:
-  GCodePrinter(double extrusion_factor, double retract_amount,
-               double temperature, double bed_temp)
-    : filament_extrusion_factor_(extrusion_factor),
-      retract_amount_(retract_amount), current_feedrate_(-1),
-      temperature_(temperature), bed_temp_(bed_temp), extrude_dist_(0) {}
+GCodePrinter::GCodePrinter(OutputSink *out, const GCodeDialect *dialect,
+                           double extrusion_factor,
+                           const std::vector<ToolSettings> &tools,
+                           double bed_temp, GCodeEncoding encoding)
+  : bgcode_(encoding == GCODE_BINARY ? new BinaryGCodeSink(out) : NULL),
+    meatpack_(encoding == GCODE_MEATPACK ? CreateMeatPackSink(out) : NULL),
+    out_(bgcode_ ? bgcode_ : (meatpack_ ? meatpack_ : out)),
+    dialect_(dialect), filament_extrusion_factor_(extrusion_factor),
+    tools_(tools), current_tool_(0), current_feedrate_(-1),
+    temperature_(tools[0].temperature), bed_temp_(bed_temp),
+    last_x_(0), last_y_(0), last_z_(0),
+    extrude_dist_(0), extruded_(0), software_advance_(0),
+    progress_percent_(-1), progress_minutes_(-1),
+    // Other tools are not primed yet; consider them retracted.
+    in_retract_(tools.size(), true) {
+  in_retract_[0] = false;
+  if (bgcode_) {
+    char value[32];
+    snprintf(value, sizeof(value), "%.0f", temperature_);
+    bgcode_->AddMetadata(BinaryGCodeSink::PRINTER_METADATA,
+                         "temperature", value);
+    if (bed_temp_ > 0) {
+      snprintf(value, sizeof(value), "%.0f", bed_temp_);
+      bgcode_->AddMetadata(BinaryGCodeSink::PRINTER_METADATA,
+                           "bed_temperature", value);
+    }
+  }
+}
 
-  virtual void Preamble(const Vector2D &machine_limit,
+GCodePrinter::GCodePrinter(const GCodePrinter &other, OutputSink *out)
+  : bgcode_(NULL), meatpack_(NULL), out_(out), dialect_(other.dialect_),
+    filament_extrusion_factor_(other.filament_extrusion_factor_),
+    tools_(other.tools_), current_tool_(other.current_tool_),
+    current_feedrate_(other.current_feedrate_),
+    temperature_(other.temperature_), bed_temp_(other.bed_temp_),
+    last_x_(other.last_x_), last_y_(other.last_y_), last_z_(other.last_z_),
+    extrude_dist_(other.extrude_dist_), extruded_(other.extruded_),
+    software_advance_(other.software_advance_),
+    progress_percent_(other.progress_percent_),
+    progress_minutes_(other.progress_minutes_),
+    in_retract_(other.in_retract_) {
+}
+
+GCodePrinter *GCodePrinter::Fork(OutputSink *out) const {
+  return new GCodePrinter(*this, out);
+}
+
+void GCodePrinter::ContinueFrom(const GCodePrinter &fork) {
+  current_tool_ = fork.current_tool_;
+  current_feedrate_ = fork.current_feedrate_;
+  temperature_ = fork.temperature_;
+  last_x_ = fork.last_x_; last_y_ = fork.last_y_; last_z_ = fork.last_z_;
+  extrude_dist_ = fork.extrude_dist_;
+  extruded_ = fork.extruded_;
+  progress_percent_ = fork.progress_percent_;
+  progress_minutes_ = fork.progress_minutes_;
+  in_retract_ = fork.in_retract_;
+}
+
+// Encoders write what they still have.
+GCodePrinter::~GCodePrinter() {
+  delete bgcode_;
+  delete meatpack_;
+}
+
+void GCodePrinter::Preamble(const Vector2D &machine_limit,
+                            double feed_mm_per_sec) {
+  out_->Printf("(G-Code)\n\n");
+}
+
+void GCodePrinter::Init(const Vector2D &machine_limit,
                         double feed_mm_per_sec) {
-    printf("(G-Code)\n\n");
-  }
-
-  virtual void Init(const Vector2D &machine_limit,
-                    double feed_mm_per_sec) {
-    printf("G28\nG1 F%.1f\n", feed_mm_per_sec * 60);
-    printf("G1 Z5\n");
-    printf("M82      ; absolute E\n"
-           "G92 E0.0 ; zero E\n");
-    const bool with_heated_bed = bed_temp_ > 0 && bed_temp_ < 120;
-    if (with_heated_bed) {
-      printf("M140 S%.0f  ; not waiting for it yet\n", bed_temp_);
-    }
+  dialect_->Home(out_);
+  out_->Printf("G1 F%.1f\n", feed_mm_per_sec * 60);
+  out_->Printf("G1 Z5\n");
+  out_->Printf("M82      ; absolute E\n"
+               "G92 E0.0 ; zero E\n");
+  const bool with_heated_bed = bed_temp_ > 0 && bed_temp_ < 120;
+  if (with_heated_bed) {
+    out_->Printf("M140 S%.0f  ; not waiting for it yet\n", bed_temp_);
+  }
 
-    // Bed leveling
-    printf("\n");
-    Comment("Bed leveling\n");
-    printf("M84 E         ; turn off e motor\n");
-    printf("M109 S170     ; min temperature not have soft nozzle buggers\n");
-    printf("G1 E-2 F2400  ; retract to not ooze while bed leveling\n");
-    printf("M84 E\n");
-    printf("G28 Z0        ; Establish a general Z0\n");
-    printf("G29           ; bed levelling after everything is hot\n\n");
-
-    Comment("Wait for all temperatures reached\n");
-    printf("G1 E0\n");
-    printf("G0 X%.1f Y10 Z30 F6000 ; move to center front while heating\n",
-           machine_limit.x/2);
-
-    SetTemperature(temperature_);
-
-    // Waiting for temperature
-    printf("M109 S%.0f\n", temperature_);
-    if (with_heated_bed) {
-      printf("M190 S%.0f ; wait for bed-temp\n", bed_temp_);
-    }
+  // Bed leveling
+  out_->Printf("\n");
+  Comment("Bed leveling\n");
+  dialect_->BedLeveling(out_);
 
-    printf("M82      ; absolute E\nG92 E0.0 ; zero E\n");
-    printf("G1 E3    ; squirt out some test in air\n"); // squirt out some test
-    printf("G92 E0.0\n\n; test extrusion...\n");
-    const double test_extrusion_from = 0.5 * machine_limit.x;
-    const double test_extrusion_to = 0.1 * machine_limit.x;
-    SetSpeed(300.0);
-    MoveTo(Vector2D(test_extrusion_from, 10), 0.2);
-    SetSpeed(15);
-    ExtrudeTo(Vector2D((test_extrusion_from + test_extrusion_to)/2, 10),
-              0.2, 1.0);
-    // Remaining just move to wipe nozzle properly.
-    MoveTo(Vector2D(test_extrusion_to, 10), 0.2);
-    Retract();
-    GoZPos(5);
-  }
-  virtual void Postamble() {
-    printf("M104 S0 ; hotend off\n");
-    printf("M140 S0 ; heated bed off\n");
-    printf("M106 S0 ; fan off\n");
-    printf("G1 X0\n");  // We keep z-axis as is.
-    printf("G92 E0.0\n");
-    printf("M84\n");
-  }
-  virtual void SetTemperature(double temperature) {
-    if (temperature != temperature_)
-      printf("M104 S%.0f\n", temperature);
-    temperature_ = temperature;
-  }
-  virtual double GetExtrusionDistance() { return extrude_dist_; }
-  virtual void Comment(const char *fmt, ...) {
-    printf("; ");   // TODO: not all printers might be able to deal with ';'
-    va_list ap; va_start(ap, fmt); vprintf(fmt, ap); va_end(ap);
-  }
-
-  virtual void SetSpeed(double feed_mm_per_sec) {
-    if (feed_mm_per_sec != current_feedrate_) {
-      printf("G1 F%.1f  ; feedrate=%.1fmm/s\n", feed_mm_per_sec * 60,
-             feed_mm_per_sec);
-      current_feedrate_ = feed_mm_per_sec;
-    }
+  Comment("Wait for all temperatures reached\n");
+  out_->Printf("G1 E0\n");
+  out_->Printf("G0 X%.1f Y10 Z30 F6000 ; move to center front while heating\n",
+               machine_limit.x/2);
+
+  SetTemperature(temperature_);
+
+  // Waiting for temperature
+  out_->Printf("M109 S%.0f\n", temperature_);
+  if (with_heated_bed) {
+    out_->Printf("M190 S%.0f ; wait for bed-temp\n", bed_temp_);
   }
-  virtual void GoZPos(double z) {
-    printf("G1 Z%.3f\n", z);
-  }
-  virtual void MoveTo(const Vector2D &pos, double z) {
-    printf("G1 X%.3f Y%.3f Z%.3f\n", pos.x, pos.y, z);
-    last_x = pos.x; last_y = pos.y; last_z = z;
-  }
-  virtual void ExtrudeTo(const Vector2D &pos, double z,
-                         double extrusion_multiplier) {
-    extrude_dist_ += distance(pos.x - last_x, pos.y - last_y, z - last_z);
-    printf("G1 X%.3f Y%.3f Z%.3f E%.3f\n", pos.x, pos.y, z,
-           extrude_dist_ * filament_extrusion_factor_ * extrusion_multiplier);
-    last_x = pos.x; last_y = pos.y; last_z = z;
-  }
-  virtual void ResetExtrude() {
-    assert(in_retract_);
-    in_retract_ = false;
-    printf("M83      ; relative E\n"  // extruder relative mode
-           "G1 E%.1f  ; filament back to nozzle tip\n"
-           "M82      ; absolute E\n", // extruder absolute mode
-           1.1 * retract_amount_);  // fudging... a bit more squeeze.
-    printf("G92 E0.0 ; start extrusion, set E to zero\n");
-    extrude_dist_ = 0;
-  }
-  virtual void Retract() {
-    assert(!in_retract_);
-    printf("M83      ; relative E\n"
-           "G1 E%.1f ; retract\n"
-           "M82      ; Back to absolute\n", -retract_amount_);
-    in_retract_ = true;
-  }
-  virtual void SwitchFan(bool on) {
-    printf("M106 S%d\n", on ? 255 : 0);
-  }
-
-private:
-  const double filament_extrusion_factor_;
-  const double retract_amount_;
-  double current_feedrate_;
-  double temperature_;
-  double bed_temp_;
-  double last_x, last_y, last_z;
-  double extrude_dist_;
-  bool in_retract_ = false;
-};
-
-class PostScriptPrinter : public Printer {
-public:
-  PostScriptPrinter(bool show_move_as_line, double line_thickness)
-    : show_move_as_line_(show_move_as_line), line_thickness_(line_thickness),
-      in_move_color_(false), r_(0), g_(0), b_(0) {
-  }
-  virtual void Preamble(const Vector2D &machine_limit,
-                        double feed_mm_per_sec) {
-    const float mm_to_point = 1 / 25.4 * 72.0;
-    printf("%%!PS-Adobe-3.0\n%%%%BoundingBox: 0 0 %.0f %.0f\n\n",
-           machine_limit.x * mm_to_point, machine_limit.y * mm_to_point);
-  }
-  virtual void Init(const Vector2D &machine_limit,
-                    double feed_mm_per_sec) {
-    printf("/extrude-to { lineto } def\n");
-    printf("72.0 25.4 div dup scale  %% Switch to mm\n");
-    printf("1 setlinejoin\n");
-    printf("%.2f setlinewidth %% mm\n", line_thickness_);
-    printf("0 0 moveto\n");
-  }
-
-  virtual void Postamble() {
-    printf("stroke\nshowpage\n");
-  }
-  virtual void Comment(const char *fmt, ...) {
-    printf("%% ");
-    va_list ap; va_start(ap, fmt); vprintf(fmt, ap); va_end(ap);
-  }
-  virtual void SetSpeed(double feed_mm_per_sec) {}
-  virtual void SetTemperature(double t) {}
-  virtual void ResetExtrude() {
-    printf("%% Flush lines but remember where we are.\n"
-           "currentpoint\nstroke\nmoveto\n");
-  }
-  virtual void Retract() {}
-  virtual void GoZPos(double z) {}
-  virtual void MoveTo(const Vector2D &pos, double z) {
-    if (show_move_as_line_) {
-      if (!in_move_color_) {
-        ColorSwitch(0, 0, 0, 0.9);  // blue move color
-        in_move_color_ = true;
-      }
-      printf("%.3f %.3f lineto\n", pos.x, pos.y);
-    } else {
-      printf("%.3f %.3f moveto\n", pos.x, pos.y);
-    }
+
+  out_->Printf("M82      ; absolute E\nG92 E0.0 ; zero E\n");
+  out_->Printf("G1 E3    ; squirt out some test in air\n"); // squirt out some test
+  out_->Printf("G92 E0.0\n\n; test extrusion...\n");
+  const double test_extrusion_from = 0.5 * machine_limit.x;
+  const double test_extrusion_to = 0.1 * machine_limit.x;
+  SetSpeed(300.0);
+  MoveTo(Vector2D(test_extrusion_from, 10), 0.2);
+  SetSpeed(15);
+  ExtrudeTo(Vector2D((test_extrusion_from + test_extrusion_to)/2, 10),
+            0.2, 1.0);
+  // Remaining just move to wipe nozzle properly.
+  MoveTo(Vector2D(test_extrusion_to, 10), 0.2);
+  Retract();
+  GoZPos(5);
+}
+
+void GCodePrinter::Postamble() {
+  for (size_t t = 1; t < tools_.size(); ++t) {
+    if ((int)t != current_tool_) out_->Printf("M104 T%d S0\n", (int)t);
   }
-  virtual void ExtrudeTo(const Vector2D &pos, double /*z*/,
-                         double /*extrusion_multiplier*/) {
-    if (in_move_color_) {
-      ColorSwitch(line_thickness_, r_, g_, b_);
-      in_move_color_ = false;
-    }
-    printf("%.3f %.3f extrude-to\n", pos.x, pos.y);
-  }
-  virtual void SwitchFan(bool on) {}
-  virtual double GetExtrusionDistance() { return 0; }
-  virtual void SetColor(float r, float g, float b) {
-    r_ = r; g_ = g; b_ = b;
-    if (!in_move_color_) {
-      ColorSwitch(line_thickness_, r, g, b);
+  out_->Printf("M104 S0 ; hotend off\n");
+  out_->Printf("M140 S0 ; heated bed off\n");
+  out_->Printf("M106 S0 ; fan off\n");
+  out_->Printf("G1 X0\n");  // We keep z-axis as is.
+  out_->Printf("G92 E0.0\n");
+  out_->Printf("M84\n");
+}
+
+void GCodePrinter::SetTemperature(double temperature) {
+  if (temperature != temperature_ && out_)
+    out_->Printf("M104 S%.0f\n", temperature);
+  temperature_ = temperature;
+}
+
+void GCodePrinter::Comment(const char *fmt, ...) {
+  out_->Printf("%s", dialect_->comment_start());
+  va_list ap; va_start(ap, fmt); out_->VPrintf(fmt, ap); va_end(ap);
+}
+
+void GCodePrinter::ResetExtrude() {
+  assert(in_retract_[current_tool_]);
+  in_retract_[current_tool_] = false;
+  out_->Printf("M83      ; relative E\n"  // extruder relative mode
+               "G1 E%.1f  ; filament back to nozzle tip\n"
+               "M82      ; absolute E\n", // extruder absolute mode
+               1.1 * tools_[current_tool_].retract);  // fudging... a bit more squeeze.
+  out_->Printf("G92 E0.0 ; start extrusion, set E to zero\n");
+  extrude_dist_ = 0;
+  extruded_ = 0;
+}
+
+void GCodePrinter::Retract() {
+  assert(!in_retract_[current_tool_]);
+  out_->Printf("M83      ; relative E\n"
+               "G1 E%.1f ; retract\n"
+               "M82      ; Back to absolute\n", -tools_[current_tool_].retract);
+  in_retract_[current_tool_] = true;
+}
+
+void GCodePrinter::SwitchFan(bool on) {
+  if (out_) out_->Printf("M106 S%d\n", on ? 255 : 0);
+}
+
+void GCodePrinter::SelectTool(int tool) {
+  assert(tool >= 0 && tool < (int)tools_.size());
+  if (tool == current_tool_)
+    return;
+  current_tool_ = tool;
+  temperature_ = tools_[tool].temperature;
+  out_->Printf("T%d\n", tool);
+  out_->Printf("M109 S%.0f ; wait for tool temperature\n", temperature_);
+}
+
+void GCodePrinter::SetToolTemperature(int tool, double temperature) {
+  if (tool == current_tool_) {
+    SetTemperature(temperature);
+  } else if (out_) {
+    out_->Printf("M104 T%d S%.0f\n", tool, temperature);
+  }
+}
+
+void GCodePrinter::SetMotionLimits(double velocity, double accel) {
+  dialect_->SetMotionLimits(out_, velocity, accel);
+}
+
+static std::string Base64Encode(const std::string &in) {
+  static const char kAlphabet[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  std::string out;
+  out.reserve((in.size() + 2) / 3 * 4);
+  for (size_t i = 0; i < in.size(); i += 3) {
+    const size_t remaining = in.size() - i;
+    uint32_t bits = (uint8_t) in[i] << 16;
+    if (remaining > 1) bits |= (uint8_t) in[i+1] << 8;
+    if (remaining > 2) bits |= (uint8_t) in[i+2];
+    out.push_back(kAlphabet[(bits >> 18) & 0x3f]);
+    out.push_back(kAlphabet[(bits >> 12) & 0x3f]);
+    out.push_back(remaining > 1 ? kAlphabet[(bits >> 6) & 0x3f] : '=');
+    out.push_back(remaining > 2 ? kAlphabet[bits & 0x3f] : '=');
+  }
+  return out;
+}
+
+void GCodePrinter::AddThumbnail(const RasterImage &image) {
+  std::string png;
+  image.EncodePNG(&png);
+  if (bgcode_) {   // Has its own block for it.
+    bgcode_->AddThumbnail(image.width(), image.height(), png);
+    return;
+  }
+  const std::string encoded = Base64Encode(png);
+  // Format as understood by PrusaSlicer compatible firmware and frontends.
+  out_->Printf("\n");
+  Comment("thumbnail begin %dx%d %d\n", image.width(), image.height(),
+          (int) encoded.size());
+  for (size_t pos = 0; pos < encoded.size(); pos += 78) {
+    Comment("%s\n", encoded.substr(pos, 78).c_str());
+  }
+  Comment("thumbnail end\n");
+  out_->Printf("\n");
+}
+
+void GCodePrinter::SetTotals(double print_seconds, double filament_mm) {
+  int t = (int) print_seconds;
+  char time_str[32], filament_str[32];
+  snprintf(time_str, sizeof(time_str), "%dh %dm %ds",
+           t / 3600, (t % 3600) / 60, t % 60);
+  snprintf(filament_str, sizeof(filament_str), "%.2f", filament_mm);
+  if (bgcode_) {   // Shown from the metadata.
+    bgcode_->AddMetadata(BinaryGCodeSink::PRINT_METADATA,
+                         "estimated printing time (normal mode)", time_str);
+    bgcode_->AddMetadata(BinaryGCodeSink::PRINT_METADATA,
+                         "filament used [mm]", filament_str);
+  }
+  const std::string totals = TotalsText(time_str, filament_str);
+  out_->Write(totals.data(), totals.size());
+}
+
+void GCodePrinter::SetProgress(double fraction, double remaining_seconds) {
+  const int percent = std::max(0, std::min(100, (int) (fraction * 100)));
+  const int minutes = std::max(0, (int) ceil(remaining_seconds / 60));
+  if (percent == progress_percent_ && minutes == progress_minutes_)
+    return;
+  if (out_) out_->Printf("M73 P%d R%d\n", percent, minutes);
+  progress_percent_ = percent;
+  progress_minutes_ = minutes;
+}
+
+void GCodePrinter::SetPressureAdvance(double k, bool in_firmware) {
+  if (in_firmware) {
+    for (size_t t = 0; t < tools_.size(); ++t)
+      dialect_->SetPressureAdvance(out_, t, k);
+    software_advance_ = 0;
+  } else {
+    Comment("Pressure advance K=%.3f applied to E values\n", k);
+    software_advance_ = k;
+  }
+}
+
+std::string GCodePrinter::TotalsText(const char *time_str,
+                                     const char *filament_str) {
+  char buffer[256];
+  snprintf(buffer, sizeof(buffer),
+           "%sestimated printing time (normal mode) = %s\n"
+           "%sfilament used [mm] = %s\n",
+           dialect_->comment_start(), time_str,
+           dialect_->comment_start(), filament_str);
+  return buffer;
+}
+
+// Calls per part. Large enough that starting a thread and the fork don't
+// matter, small enough to keep the recorded calls in the cache.
+static const size_t kOpsPerPart = 16384;
+
+ParallelGCodeWriter::ParallelGCodeWriter(GCodePrinter *printer, int threads)
+  : printer_(printer), threads_(std::max(1, threads)),
+    tracker_(printer->Fork(NULL)) {
+  ops_.reserve(threads_ * kOpsPerPart);
+}
+
+ParallelGCodeWriter::~ParallelGCodeWriter() {
+  Flush();
+  printer_->ContinueFrom(*tracker_);
+  delete tracker_;
+}
+
+void ParallelGCodeWriter::Comment(const char *fmt, ...) {
+  char buffer[1024];
+  va_list ap; va_start(ap, fmt);
+  vsnprintf(buffer, sizeof(buffer), fmt, ap);
+  va_end(ap);
+  Add(Op(Op::COMMENT, 0));
+  ops_.back().index = comments_.size();   // Add() might have flushed them.
+  comments_.push_back(buffer);
+}
+
+// Called before the call is passed on to the tracker, so a new part starts
+// with the state before "op".
+void ParallelGCodeWriter::Add(const Op &op) {
+  if (ops_.size() % kOpsPerPart == 0) {
+    if (parts_.size() == threads_)
+      Flush();
+    Part part;
+    part.first_op = ops_.size();
+    part.gcode = new std::string();
+    part.sink = CreateBufferSink(part.gcode);
+    part.printer = tracker_->Fork(part.sink);
+    parts_.push_back(part);
+  }
+  ops_.push_back(op);
+}
+
+void ParallelGCodeWriter::Format(const Part &part, size_t end_op) {
+  GCodePrinter *const p = part.printer;
+  for (size_t i = part.first_op; i < end_op; ++i) {
+    const Op &op = ops_[i];
+    switch (op.kind) {
+    case Op::MOVE: p->MoveTo(op.pos, op.value); break;
+    case Op::EXTRUDE: p->ExtrudeTo(op.pos, op.value, op.value2); break;
+    case Op::SPEED: p->SetSpeed(op.value); break;
+    case Op::TEMPERATURE: p->SetTemperature(op.value); break;
+    case Op::TOOL_TEMPERATURE:
+      p->SetToolTemperature(op.index, op.value);
+      break;
+    case Op::PROGRESS: p->SetProgress(op.value, op.value2); break;
+    case Op::FAN: p->SwitchFan(op.index != 0); break;
+    case Op::COMMENT: p->Comment("%s", comments_[op.index].c_str()); break;
     }
   }
-private:
-  void ColorSwitch(float line_width, float r, float g, float b) {
-    printf("currentpoint\nstroke\n");   // finish last path; remember pos
-    printf("%.1f setlinewidth %% mm\n", line_width);
-    printf("%.1f %.1f %.1f setrgbcolor\n", r, g, b);
-    printf("moveto\n");   // set current point to remembered pos.
+}
+
+void ParallelGCodeWriter::Flush() {
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < parts_.size(); ++i) {
+    const size_t end_op = (i + 1 < parts_.size())
+      ? parts_[i + 1].first_op : ops_.size();
+    threads.push_back(std::thread(&ParallelGCodeWriter::Format, this,
+                                  parts_[i], end_op));
+  }
+  if (!parts_.empty()) {
+    Format(parts_[0], parts_.size() > 1 ? parts_[1].first_op : ops_.size());
+  }
+  for (std::thread &t : threads)
+    t.join();
+  for (const Part &part : parts_) {
+    printer_->Append(*part.gcode);
+    delete part.printer;
+    delete part.sink;
+    delete part.gcode;
+  }
+  parts_.clear();
+  ops_.clear();
+  comments_.clear();
+}
+
+PostScriptPrinter::PostScriptPrinter(OutputSink *out, bool show_move_as_line,
+                                     double line_thickness)
+  : out_(out), show_move_as_line_(show_move_as_line), line_thickness_(line_thickness),
+    in_move_color_(false), r_(0), g_(0), b_(0) {
+}
+
+void PostScriptPrinter::Preamble(const Vector2D &machine_limit,
+                                 double feed_mm_per_sec) {
+  const float mm_to_point = 1 / 25.4 * 72.0;
+  out_->Printf("%%!PS-Adobe-3.0\n%%%%BoundingBox: 0 0 %.0f %.0f\n\n",
+               machine_limit.x * mm_to_point, machine_limit.y * mm_to_point);
+}
+
+void PostScriptPrinter::Init(const Vector2D &machine_limit,
+                             double feed_mm_per_sec) {
+  out_->Printf("/extrude-to { lineto } def\n");
+  out_->Printf("72.0 25.4 div dup scale  %% Switch to mm\n");
+  out_->Printf("1 setlinejoin\n");
+  out_->Printf("%.2f setlinewidth %% mm\n", line_thickness_);
+  out_->Printf("0 0 moveto\n");
+}
+
+void PostScriptPrinter::Postamble() {
+  out_->Printf("stroke\nshowpage\n");
+}
+
+void PostScriptPrinter::Comment(const char *fmt, ...) {
+  out_->Printf("%% ");
+  va_list ap; va_start(ap, fmt); out_->VPrintf(fmt, ap); va_end(ap);
+}
+
+void PostScriptPrinter::ResetExtrude() {
+  out_->Printf("%% Flush lines but remember where we are.\n"
+               "currentpoint\nstroke\nmoveto\n");
+}
+
+void PostScriptPrinter::SetColor(float r, float g, float b) {
+  r_ = r; g_ = g; b_ = b;
+  if (!in_move_color_) {
+    ColorSwitch(line_thickness_, r, g, b);
   }
+}
 
-  const bool show_move_as_line_;
-  const float line_thickness_;
-  bool in_move_color_;
-  float r_, g_, b_;   // color.
-};
+void PostScriptPrinter::ColorSwitch(float line_width,
+                                    float r, float g, float b) {
+  out_->Printf("currentpoint\nstroke\n");   // finish last path; remember pos
+  out_->Printf("%.1f setlinewidth %% mm\n", line_width);
+  out_->Printf("%.1f %.1f %.1f setrgbcolor\n", r, g, b);
+  out_->Printf("moveto\n");   // set current point to remembered pos.
+}
 
-}  // end anonymous namespace.
+SVGPrinter::SVGPrinter(OutputSink *out, bool show_move_as_line,
+                       double line_thickness)
+  : out_(out), show_move_as_line_(show_move_as_line), line_thickness_(line_thickness),
+    in_polyline_(false), last_x_(0), last_y_(0), r_(0), g_(0), b_(0) {
+}
+
+void SVGPrinter::Preamble(const Vector2D &machine_limit,
+                          double feed_mm_per_sec) {
+  out_->Printf("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+  out_->Printf("<svg xmlns=\"http://www.w3.org/2000/svg\" "
+               "width=\"%.0fmm\" height=\"%.0fmm\" viewBox=\"0 0 %.0f %.0f\">\n",
+               machine_limit.x, machine_limit.y, machine_limit.x, machine_limit.y);
+  // Origin bottom left as on the printbed.
+  out_->Printf("<g transform=\"translate(0,%.0f) scale(1,-1)\" fill=\"none\" "
+               "stroke-linejoin=\"round\" stroke-linecap=\"round\">\n",
+               machine_limit.y);
+}
+
+void SVGPrinter::Postamble() {
+  EndPolyline();
+  out_->Printf("</g>\n</svg>\n");
+}
+
+void SVGPrinter::Comment(const char *fmt, ...) {
+  char buffer[1024];
+  va_list ap; va_start(ap, fmt);
+  vsnprintf(buffer, sizeof(buffer), fmt, ap);
+  va_end(ap);
+  EndPolyline();
+  // "--" is not allowed within XML comments.
+  std::string text;
+  for (const char *c = buffer; *c && *c != '\n'; ++c) {
+    if (*c == '-' && !text.empty() && text[text.size()-1] == '-')
+      text.push_back(' ');
+    text.push_back(*c);
+  }
+  out_->Printf("<!-- %s -->\n", text.c_str());
+}
+
+void SVGPrinter::MoveTo(const Vector2D &pos, double z) {
+  EndPolyline();
+  if (show_move_as_line_ && (pos.x != last_x_ || pos.y != last_y_)) {
+    out_->Printf("<line x1=\"%.3f\" y1=\"%.3f\" x2=\"%.3f\" y2=\"%.3f\" "
+                 "stroke=\"blue\" stroke-width=\"0.1\"/>\n",
+                 last_x_, last_y_, pos.x, pos.y);
+  }
+  last_x_ = pos.x; last_y_ = pos.y;
+}
+
+void SVGPrinter::SetColor(float r, float g, float b) {
+  EndPolyline();
+  r_ = r; g_ = g; b_ = b;
+}
+
+void SVGPrinter::StartPolyline() {
+  out_->Printf("<polyline stroke=\"rgb(%d,%d,%d)\" stroke-width=\"%.2f\" "
+               "points=\"%.3f,%.3f", (int)(255 * r_), (int)(255 * g_),
+               (int)(255 * b_), line_thickness_, last_x_, last_y_);
+  in_polyline_ = true;
+}
+
+void SVGPrinter::EndPolyline() {
+  if (in_polyline_) out_->Printf("\"/>\n");
+  in_polyline_ = false;
+}
+
+PNGPrinter::PNGPrinter(OutputSink *out, PreviewView view,
+                       bool show_move_as_line, double line_thickness,
+                       double pixel_per_mm, double max_z)
+  : out_(out), view_(view), show_move_as_line_(show_move_as_line),
+    line_thickness_(line_thickness), pixel_per_mm_(pixel_per_mm),
+    max_z_(max_z), image_(NULL), last_x_(0), last_y_(0), last_z_(0),
+    r_(0), g_(0), b_(0) {
+}
+
+PNGPrinter::~PNGPrinter() { delete image_; }
+
+void PNGPrinter::Preamble(const Vector2D &machine_limit,
+                          double feed_mm_per_sec) {
+  const double height_mm = (view_ == VIEW_TOP) ? machine_limit.y : max_z_;
+  image_ = new RasterImage(ceil(machine_limit.x * pixel_per_mm_),
+                           ceil(height_mm * pixel_per_mm_));
+}
+
+void PNGPrinter::Postamble() {
+  std::string png;
+  image_->EncodePNG(&png);
+  out_->Write(png.data(), png.size());
+}
+
+void PNGPrinter::DrawTo(const Vector2D &pos, double z, double width_mm,
+                        float r, float g, float b) {
+  // Image y goes downwards.
+  const double h = image_->height();
+  const double ppm = pixel_per_mm_;
+  if (view_ == VIEW_TOP) {
+    // Higher layers cover lower ones; make them lighter to see the shape.
+    const float fade = 0.8 * std::min(1.0, std::max(0.0, z / max_z_));
+    image_->DrawLine(last_x_ * ppm, h - last_y_ * ppm, pos.x * ppm,
+                     h - pos.y * ppm, width_mm * ppm,
+                     r + (1 - r) * fade, g + (1 - g) * fade,
+                     b + (1 - b) * fade);
+  } else {
+    image_->DrawLine(last_x_ * ppm, h - last_z_ * ppm, pos.x * ppm,
+                     h - z * ppm, width_mm * ppm, r, g, b);
+  }
+}
+
+// Each printer with its own type, see Printer::Extrude().
+void GCodePrinter::Extrude(const Polygon &polygon, const Vector2D &center,
+                           const ExtrusionParams &params) {
+  if (params.threads > 1) {
+    ParallelGCodeWriter writer(this, params.threads);
+    CreateExtrusion(polygon, &writer, center, params);
+  } else {
+    CreateExtrusion(polygon, this, center, params);
+  }
+}
+
+void PostScriptPrinter::Extrude(const Polygon &polygon,
+                                const Vector2D &center,
+                                const ExtrusionParams &params) {
+  CreateExtrusion(polygon, this, center, params);
+}
+
+void SVGPrinter::Extrude(const Polygon &polygon, const Vector2D &center,
+                         const ExtrusionParams &params) {
+  CreateExtrusion(polygon, this, center, params);
+}
+
+void PNGPrinter::Extrude(const Polygon &polygon, const Vector2D &center,
+                         const ExtrusionParams &params) {
+  CreateExtrusion(polygon, this, center, params);
+}
+
+void CountingPrinter::Extrude(const Polygon &polygon, const Vector2D &center,
+                              const ExtrusionParams &params) {
+  CreateExtrusion(polygon, this, center, params);
+}
 
 // Public interface
-Printer *CreateGCodePrinter(double extrusion_mm_to_e_axis_factor,
-                            double retract_amount,
-                            double temp, double bed_temp) {
-  return new GCodePrinter(extrusion_mm_to_e_axis_factor, retract_amount,
-                          temp, bed_temp);
+Printer *CreateGCodePrinter(OutputSink *out, const GCodeDialect *dialect,
+                            double extrusion_mm_to_e_axis_factor,
+                            const std::vector<ToolSettings> &tools,
+                            double bed_temp, GCodeEncoding encoding) {
+  assert(dialect != NULL && !tools.empty());
+  return new GCodePrinter(out, dialect, extrusion_mm_to_e_axis_factor,
+                          tools, bed_temp, encoding);
 }
-Printer *CreatePostscriptPrinter(bool show_move_as_line,
+Printer *CreatePostscriptPrinter(OutputSink *out, bool show_move_as_line,
                                  double line_thickness_mm) {
-  return new PostScriptPrinter(show_move_as_line, line_thickness_mm);
+  return new PostScriptPrinter(out, show_move_as_line, line_thickness_mm);
+}
+Printer *CreateSVGPrinter(OutputSink *out, bool show_move_as_line,
+                          double line_thickness_mm) {
+  return new SVGPrinter(out, show_move_as_line, line_thickness_mm);
+}
+Printer *CreatePNGPrinter(OutputSink *out, PreviewView view,
+                          bool show_move_as_line, double line_thickness_mm,
+                          double pixel_per_mm, double max_z) {
+  return new PNGPrinter(out, view, show_move_as_line, line_thickness_mm,
+                        pixel_per_mm, max_z);
+}
+Printer *CreateCountingPrinter(PrinterCounts *counts) {
+  return new CountingPrinter(counts);
 }
@@ -5,8 +5,15 @@
 #ifndef SHELL_EXTRUDE_PRINTER_H_
 #define SHELL_EXTRUDE_PRINTER_H_
 
+#include <vector>
+
 #include "multi-shell-extrude.h"
 
+class GCodeDialect;
+class OutputSink;
+class RasterImage;
+struct ExtrusionParams;
+
 // Define this with empty, if you're not using gcc.
 #ifdef __GNUC__
 #  define PRINTF_FMT_CHECK(fmt_pos, args_pos) \
@@ -21,6 +28,8 @@
 // output.
 class Printer {
 public:
+  virtual ~Printer() {}
+
   // Preamble: what to do to start the file.
   virtual void Preamble(const Vector2D &machine_limit,
                         double feed_mm_per_sec) = 0;
@@ -47,22 +56,96 @@ public:
                          double extrusion_multiplier) = 0;
   virtual void SwitchFan(bool on) = 0;
   virtual double GetExtrusionDistance() = 0;
+
+  // Print the shell "polygon" (centroid on (0,0)) around "center" as
+  // described by "params". Printers implement this by calling
+  // CreateExtrusion() (extrusion.h) with their own type, so that the calls
+  // per vertex are not virtual.
+  virtual void Extrude(const Polygon &polygon, const Vector2D &center,
+                       const ExtrusionParams &params) = 0;
   // Nice-to-have. Mostly for visualization reasons, doesn't change
   virtual void SetColor(float r, float g, float b) {}
+
+  // Multiple extruders. Tool 0 is active initially. SetTemperature() always
+  // applies to the current tool.
+  // Switch to the given tool; waits until it is at temperature.
+  virtual void SelectTool(int tool) {}
+  // Set temperature of any tool without waiting, e.g. to preheat the next
+  // one while still printing with the current one.
+  virtual void SetToolTemperature(int tool, double temperature) {}
+
+  // Limit velocity (mm/s) and acceleration (mm/s^2) in the firmware. Values
+  // <= 0 leave the firmware setting as is.
+  virtual void SetMotionLimits(double velocity, double accel) {}
+
+  // Pressure advance factor K in seconds. If "in_firmware" is true, the
+  // firmware is asked to do it, otherwise the extra filament is added to the
+  // E-axis values we emit: K * filament speed at the current feedrate.
+  virtual void SetPressureAdvance(double k, bool in_firmware) {}
+
+  // Embed a preview image in the header, for printer displays and frontends.
+  virtual void AddThumbnail(const RasterImage &image) {}
+
+  // Frontends expect totals such as the print time in the header. Called
+  // while writing the header, so the totals need to be known before the
+  // toolpaths are printed.
+  virtual void SetTotals(double print_seconds, double filament_mm) {}
+
+  // Progress as "fraction" done, and the remaining time, for the printer
+  // display. Can be called often; only changes are sent to the printer.
+  virtual void SetProgress(double fraction, double remaining_seconds) {}
 };
 
-// Create a printer that outputs GCode to stdout.
+// Settings per extruder.
+struct ToolSettings {
+  double temperature;
+  double retract;   // Millimeter of filament to retract.
+};
+
+// All printers write their output to "out", which needs to outlive them.
+
+// Create a printer that outputs GCode.
 // "extrusion_mm_to_e_axis_factor" translates mm extruded length to E-axis
-// output.
-Printer *CreateGCodePrinter(double extrusion_mm_to_e_axis_factor,
-                            double retract,
-                            double temperature, double bed_temp);
+// output. Needs settings for at least one tool. Firmware specific commands
+// are taken from "dialect". The GCode is written as text or in one of
+// the compact encodings in gcode-encoding.h.
+enum GCodeEncoding { GCODE_TEXT, GCODE_BINARY, GCODE_MEATPACK };
+Printer *CreateGCodePrinter(OutputSink *out, const GCodeDialect *dialect,
+                            double extrusion_mm_to_e_axis_factor,
+                            const std::vector<ToolSettings> &tools,
+                            double bed_temp, GCodeEncoding encoding);
 
-// Create printer that outputs PostScript to stdout.
+// Create printer that outputs PostScript.
 // If "show_move_as_line" is true, visualizes moves as blue lines.
-Printer *CreatePostscriptPrinter(bool show_move_as_line,
+Printer *CreatePostscriptPrinter(OutputSink *out, bool show_move_as_line,
                                  double line_thickness_mm);
 
+// Create printer that outputs SVG. Parameters as in PostScript.
+Printer *CreateSVGPrinter(OutputSink *out, bool show_move_as_line,
+                          double line_thickness_mm);
+
+// Create printer that renders a PNG image, either looking at the bed from
+// the top or from the front. The image covers the bed width and the bed
+// depth or "max_z" respectively.
+enum PreviewView { VIEW_TOP, VIEW_SIDE };
+Printer *CreatePNGPrinter(OutputSink *out, PreviewView view,
+                          bool show_move_as_line, double line_thickness_mm,
+                          double pixel_per_mm, double max_z);
+
+// What a counting printer has seen.
+struct PrinterCounts {
+  PrinterCounts() : moves(0), extrusions(0), speed_changes(0),
+                    extrusion_mm(0) {}
+  long moves;
+  long extrusions;
+  long speed_changes;
+  double extrusion_mm;
+};
+
+// Create printer that does not output anything but counts the toolpath
+// segments in "counts", which needs to outlive it.
+Printer *CreateCountingPrinter(PrinterCounts *counts);
+
 #undef PRINTF_FMT_CHECK
 
 #endif // SHELL_EXTRUDE_PRINTER_H_
@@ -0,0 +1,266 @@
+/* -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+ * (c) 2014 Henner Zeller <h.zeller@acm.org>
+ * Creative commons BY-SA
+ */
+
+#include "raster-image.h"
+
+#include <math.h>
+
+#include <algorithm>
+
+RasterImage::RasterImage(int width, int height)
+  : width_(width), height_(height), pixels_(3 * width * height, 0xff) {
+}
+
+void RasterImage::Blend(int x, int y, float coverage,
+                        float r, float g, float b) {
+  uint8_t *p = &pixels_[3 * (y * width_ + x)];
+  p[0] += (int) lround(coverage * (255 * r - p[0]));
+  p[1] += (int) lround(coverage * (255 * g - p[1]));
+  p[2] += (int) lround(coverage * (255 * b - p[2]));
+}
+
+// Scanline rendering: for each row the line touches, determine the span of
+// pixels that could be reached and set coverage from the distance of the
+// pixel center to the line.
+void RasterImage::DrawLine(double x0, double y0, double x1, double y1,
+                           double line_width, float r, float g, float b) {
+  const double radius = line_width / 2;
+  const double reach = radius + 1;
+  const double dx = x1 - x0;
+  const double dy = y1 - y0;
+  const double len_sq = dx * dx + dy * dy;
+  const int row_from = std::max(0, (int) floor(std::min(y0, y1) - reach));
+  const int row_to = std::min(height_ - 1, (int) ceil(std::max(y0, y1) + reach));
+  for (int row = row_from; row <= row_to; ++row) {
+    const double yc = row + 0.5;
+    // Part of the line that is vertically within reach of this row.
+    double t_from = 0, t_to = 1;
+    if (fabs(dy) > 1e-9) {
+      t_from = (yc - reach - y0) / dy;
+      t_to = (yc + reach - y0) / dy;
+      if (t_from > t_to) std::swap(t_from, t_to);
+      t_from = std::max(0.0, t_from);
+      t_to = std::min(1.0, t_to);
+      if (t_from > t_to)
+        continue;
+    }
+    const double xa = x0 + t_from * dx, xb = x0 + t_to * dx;
+    const int col_from = std::max(0, (int) floor(std::min(xa, xb) - reach));
+    const int col_to = std::min(width_ - 1, (int) ceil(std::max(xa, xb) + reach));
+    for (int col = col_from; col <= col_to; ++col) {
+      const double xc = col + 0.5;
+      double t = 0;
+      if (len_sq > 0) {
+        t = ((xc - x0) * dx + (yc - y0) * dy) / len_sq;
+        t = std::max(0.0, std::min(1.0, t));
+      }
+      const double dist = hypot(xc - (x0 + t * dx), yc - (y0 + t * dy));
+      const double coverage = std::min(1.0, radius + 0.5 - dist);
+      if (coverage > 0)
+        Blend(col, row, coverage, r, g, b);
+    }
+  }
+}
+
+namespace {
+struct Crc32Table {
+  Crc32Table() {
+    for (uint32_t n = 0; n < 256; ++n) {
+      uint32_t c = n;
+      for (int k = 0; k < 8; ++k)
+        c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+      value[n] = c;
+    }
+  }
+  uint32_t value[256];
+};
+}  // end anonymous namespace.
+
+uint32_t Crc32(uint32_t crc, const uint8_t *data, size_t len) {
+  // Initialization of function statics is thread-safe, so images can be
+  // encoded from multiple threads.
+  static const Crc32Table table;
+  crc = ~crc;
+  for (size_t i = 0; i < len; ++i)
+    crc = table.value[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+  return ~crc;
+}
+
+static void AppendBigEndian32(uint32_t value, std::string *out) {
+  out->push_back(value >> 24);
+  out->push_back(value >> 16);
+  out->push_back(value >> 8);
+  out->push_back(value);
+}
+
+static void AppendChunk(const char *type, const std::string &data,
+                        std::string *out) {
+  AppendBigEndian32(data.size(), out);
+  const size_t type_start = out->size();
+  out->append(type, 4);
+  out->append(data);
+  AppendBigEndian32(Crc32(0, (const uint8_t*) out->data() + type_start,
+                          4 + data.size()),
+                    out);
+}
+
+// Writes bits LSB first as needed by deflate.
+class BitWriter {
+public:
+  explicit BitWriter(std::string *out) : out_(out), bits_(0), count_(0) {}
+  ~BitWriter() { if (count_ > 0) out_->push_back(bits_); }
+
+  void Write(uint32_t value, int bits) {
+    bits_ |= value << count_;
+    count_ += bits;
+    while (count_ >= 8) {
+      out_->push_back(bits_ & 0xff);
+      bits_ >>= 8;
+      count_ -= 8;
+    }
+  }
+  // Huffman codes are defined MSB first.
+  void WriteReversed(uint32_t code, int bits) {
+    uint32_t reversed = 0;
+    for (int i = 0; i < bits; ++i, code >>= 1)
+      reversed = (reversed << 1) | (code & 1);
+    Write(reversed, bits);
+  }
+
+private:
+  std::string *const out_;
+  uint32_t bits_;
+  int count_;
+};
+
+// Literal or length symbol with the fixed Huffman code of deflate.
+static void WriteFixedSymbol(int symbol, BitWriter *out) {
+  if (symbol < 144)      out->WriteReversed(0x30 + symbol, 8);
+  else if (symbol < 256) out->WriteReversed(0x190 + symbol - 144, 9);
+  else if (symbol < 280) out->WriteReversed(symbol - 256, 7);
+  else                   out->WriteReversed(0xc0 + symbol - 280, 8);
+}
+
+// Single deflate block with the fixed Huffman code; matches are found with a
+// hash table of recent three-byte sequences. Not the best compression, but
+// our images are mostly background, so this goes a long way.
+static void Deflate(const std::string &in, std::string *out) {
+  static const int kLengthBase[] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+  static const int kLengthExtra[] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+  static const int kDistBase[] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+    8193, 12289, 16385, 24577 };
+  static const int kDistExtra[] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+  const int kWindow = 32768;
+  const int kMaxMatch = 258;
+  const int kMaxChain = 16;
+  const int kHashBits = 15;
+
+  const uint8_t *data = (const uint8_t*) in.data();
+  const int len = in.size();
+  std::vector<int> head(1 << kHashBits, -1);
+  std::vector<int> prev(len, -1);
+  BitWriter bits(out);
+  bits.Write(1, 1);  // Final block.
+  bits.Write(1, 2);  // Fixed Huffman.
+  int pos = 0;
+  while (pos < len) {
+    int best_len = 0, best_dist = 0;
+    if (pos + 3 <= len) {
+      const uint32_t hash = ((data[pos] << 10) ^ (data[pos+1] << 5)
+                             ^ data[pos+2]) & ((1 << kHashBits) - 1);
+      const int max_len = std::min(kMaxMatch, len - pos);
+      int candidate = head[hash];
+      for (int chain = 0; candidate >= 0 && chain < kMaxChain
+             && pos - candidate <= kWindow; ++chain) {
+        int match = 0;
+        while (match < max_len && data[candidate + match] == data[pos + match])
+          ++match;
+        if (match > best_len) {
+          best_len = match;
+          best_dist = pos - candidate;
+          if (match == max_len) break;
+        }
+        candidate = prev[candidate];
+      }
+      prev[pos] = head[hash];
+      head[hash] = pos;
+    }
+    if (best_len < 3) {
+      WriteFixedSymbol(data[pos], &bits);
+      ++pos;
+      continue;
+    }
+    int code = 0;
+    while (code < 28 && kLengthBase[code + 1] <= best_len) ++code;
+    WriteFixedSymbol(257 + code, &bits);
+    bits.Write(best_len - kLengthBase[code], kLengthExtra[code]);
+    int dist_code = 0;
+    while (dist_code < 29 && kDistBase[dist_code + 1] <= best_dist) ++dist_code;
+    bits.WriteReversed(dist_code, 5);
+    bits.Write(best_dist - kDistBase[dist_code], kDistExtra[dist_code]);
+    // Remember the skipped positions for later matches.
+    for (int i = pos + 1; i < pos + best_len && i + 3 <= len; ++i) {
+      const uint32_t hash = ((data[i] << 10) ^ (data[i+1] << 5)
+                             ^ data[i+2]) & ((1 << kHashBits) - 1);
+      prev[i] = head[hash];
+      head[hash] = i;
+    }
+    pos += best_len;
+  }
+  WriteFixedSymbol(256, &bits);  // End of block.
+}
+
+void RasterImage::EncodePNG(std::string *out) const {
+  out->append("\x89PNG\r\n\x1a\n", 8);
+
+  std::string header;
+  AppendBigEndian32(width_, &header);
+  AppendBigEndian32(height_, &header);
+  header.append("\x08\x02\x00\x00\x00", 5);  // 8 bit RGB, no interlace.
+  AppendChunk("IHDR", header, out);
+
+  // Each row is prefixed with filter type 0 (none).
+  std::string raw;
+  const size_t row_bytes = 3 * width_;
+  raw.reserve(height_ * (row_bytes + 1));
+  for (int y = 0; y < height_; ++y) {
+    raw.push_back(0);
+    raw.append((const char*) &pixels_[y * row_bytes], row_bytes);
+  }
+
+  // zlib stream: header, deflate data, Adler-32 checksum.
+  std::string zlib;
+  zlib.append("\x78\x01", 2);
+  Deflate(raw, &zlib);
+  // Adler-32. Sums can't overflow within 5552 bytes, so only then reduce.
+  uint32_t a = 1, b = 0;
+  for (size_t i = 0; i < raw.size(); /**/) {
+    const size_t chunk_end = std::min(raw.size(), i + 5552);
+    for (/**/; i < chunk_end; ++i) {
+      a += (uint8_t) raw[i];
+      b += a;
+    }
+    a %= 65521;
+    b %= 65521;
+  }
+  AppendBigEndian32((b << 16) | a, &zlib);
+  AppendChunk("IDAT", zlib, out);
+
+  AppendChunk("IEND", std::string(), out);
+}
+
+bool RasterImage::WritePNG(FILE *out) const {
+  std::string png;
+  EncodePNG(&png);
+  return fwrite(png.data(), 1, png.size(), out) == png.size();
+}
@@ -0,0 +1,49 @@
+/* -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+ * (c) 2014 Henner Zeller <h.zeller@acm.org>
+ * Creative commons BY-SA
+ */
+#ifndef SHELL_EXTRUDE_RASTER_IMAGE_H_
+#define SHELL_EXTRUDE_RASTER_IMAGE_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+// Simple RGB image we can draw anti-aliased lines into and write as PNG,
+// without needing any external library. Coordinates are in pixels, with
+// (0,0) the top left corner.
+class RasterImage {
+public:
+  // Creates a white image.
+  RasterImage(int width, int height);
+
+  int width() const { return width_; }
+  int height() const { return height_; }
+
+  // Draw line of the given width with round caps. Colors are 0..1. Pixels
+  // partially covered are blended with the existing color.
+  void DrawLine(double x0, double y0, double x1, double y1, double line_width,
+                float r, float g, float b);
+
+  // Append PNG encoding of this image to "out". We don't want to depend on
+  // zlib, so this comes with its own simple deflate implementation.
+  void EncodePNG(std::string *out) const;
+
+  // Write PNG to given file. Returns true on success.
+  bool WritePNG(FILE *out) const;
+
+private:
+  void Blend(int x, int y, float coverage, float r, float g, float b);
+
+  const int width_;
+  const int height_;
+  std::vector<uint8_t> pixels_;  // RGB, row by row.
+};
+
+// CRC-32 as used in PNG, continuing from "crc" (0 to start). Also used by
+// other binary formats.
+uint32_t Crc32(uint32_t crc, const uint8_t *data, size_t len);
+
+#endif  // SHELL_EXTRUDE_RASTER_IMAGE_H_
@@ -0,0 +1,105 @@
+/* -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+ * (c) 2014 Henner Zeller <h.zeller@acm.org>
+ * Creative commons BY-SA
+ */
+
+#include "result-cache.h"
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+uint64_t ResultCache::Hash(const std::string &data, uint64_t hash) {
+  for (size_t i = 0; i < data.size(); ++i) {
+    hash ^= (uint8_t) data[i];
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+std::string ResultCache::Filename(uint64_t key, const char *suffix) const {
+  char name[32];
+  snprintf(name, sizeof(name), "/%016" PRIx64, key);
+  return dir_ + name + suffix;
+}
+
+bool ResultCache::Fetch(uint64_t key, const char *suffix,
+                        OutputSink *out) const {
+  const int fd = open(Filename(key, suffix).c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+  struct stat st;
+  const bool success = (fstat(fd, &st) == 0
+                        && out->WriteFromFd(fd, st.st_size));
+  close(fd);
+  return success;
+}
+
+bool ResultCache::Read(uint64_t key, const char *suffix,
+                       std::string *data) const {
+  data->clear();
+  OutputSink *out = CreateBufferSink(data);
+  const bool success = Fetch(key, suffix, out);
+  delete out;
+  return success;
+}
+
+bool ResultCache::Store(uint64_t key, const char *suffix,
+                        const std::string &data) const {
+  Recorder *recorder = StartRecording(key, suffix, NULL);
+  if (recorder == NULL)
+    return false;
+  recorder->Write(data.data(), data.size());
+  const bool success = recorder->Commit();
+  delete recorder;
+  return success;
+}
+
+ResultCache::Recorder *ResultCache::StartRecording(uint64_t key,
+                                                   const char *suffix,
+                                                   OutputSink *out) const {
+  std::string temp_name = dir_ + "/.tmp-XXXXXX";
+  const int fd = mkstemp(&temp_name[0]);
+  if (fd < 0)
+    return NULL;
+  return new Recorder(out, fd, temp_name, Filename(key, suffix));
+}
+
+ResultCache::Recorder::Recorder(OutputSink *out, int fd,
+                                const std::string &temp_name,
+                                const std::string &final_name)
+  : out_(out), fd_(fd), file_(CreateFdSink(fd)), size_(0),
+    temp_name_(temp_name), final_name_(final_name) {
+}
+
+ResultCache::Recorder::~Recorder() {
+  if (file_ != NULL) {   // Not committed.
+    delete file_;
+    close(fd_);
+    unlink(temp_name_.c_str());
+  }
+}
+
+void ResultCache::Recorder::Write(const char *data, size_t len) {
+  if (out_) out_->Write(data, len);
+  file_->Write(data, len);
+  size_ += len;
+}
+
+bool ResultCache::Recorder::Commit() {
+  delete file_;   // Flushes.
+  file_ = NULL;
+  // The sink doesn't report errors, but if the disk was full, we'd see
+  // it in the size.
+  struct stat st;
+  const bool complete = (fstat(fd_, &st) == 0 && (size_t) st.st_size == size_);
+  if (close(fd_) != 0 || !complete
+      || rename(temp_name_.c_str(), final_name_.c_str()) != 0) {
+    unlink(temp_name_.c_str());
+    return false;
+  }
+  return true;
+}
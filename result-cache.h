@@ -0,0 +1,75 @@
+/* -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+ * (c) 2014 Henner Zeller <h.zeller@acm.org>
+ * Creative commons BY-SA
+ */
+#ifndef SHELL_EXTRUDE_RESULT_CACHE_H_
+#define SHELL_EXTRUDE_RESULT_CACHE_H_
+
+#include <stdint.h>
+
+#include <string>
+
+#include "output-sink.h"
+
+// Directory with files named after the hash of everything that went into
+// creating them, plus a suffix describing the kind of content. Entries are
+// written under a temporary name and renamed when complete, so multiple
+// processes or threads can share a cache directory.
+//
+// Nothing is ever removed; it is fine to delete the directory at any time,
+// e.g. after updating the program.
+class ResultCache {
+public:
+  static const uint64_t kHashStart = 0xcbf29ce484222325ULL;
+
+  // Directory needs to exist.
+  explicit ResultCache(const std::string &dir) : dir_(dir) {}
+
+  // 64 bit FNV-1a hash of "data", continuing from "hash".
+  static uint64_t Hash(const std::string &data, uint64_t hash = kHashStart);
+
+  // Stream entry to "out", if it exists. Returns true on success.
+  bool Fetch(uint64_t key, const char *suffix, OutputSink *out) const;
+
+  // Read entry into "data". Returns true on success.
+  bool Read(uint64_t key, const char *suffix, std::string *data) const;
+
+  // Store entry. Returns true on success.
+  bool Store(uint64_t key, const char *suffix, const std::string &data) const;
+
+  // Sink that passes everything on to "out" (may be NULL) and records it for
+  // a new entry at the same time. Only on Commit() the entry becomes visible;
+  // deleting the recorder before discards it.
+  class Recorder : public OutputSink {
+  public:
+    virtual ~Recorder();
+
+    virtual void Write(const char *data, size_t len);
+
+    // Make the entry available. Returns true on success.
+    bool Commit();
+
+  private:
+    friend class ResultCache;
+    Recorder(OutputSink *out, int fd, const std::string &temp_name,
+             const std::string &final_name);
+
+    OutputSink *const out_;
+    const int fd_;
+    OutputSink *file_;              // Writing the entry; NULL when done.
+    size_t size_;                   // Bytes written to the entry.
+    const std::string temp_name_;
+    const std::string final_name_;
+  };
+
+  // Returns NULL if the entry can't be created.
+  Recorder *StartRecording(uint64_t key, const char *suffix,
+                           OutputSink *out) const;
+
+private:
+  std::string Filename(uint64_t key, const char *suffix) const;
+
+  const std::string dir_;
+};
+
+#endif  // SHELL_EXTRUDE_RESULT_CACHE_H_
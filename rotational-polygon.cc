@@ -71,6 +71,7 @@ Polygon RotationalPolygon(const char *fun_init, double inner_radius,
   if (fabs(twist) > 0.05) {
     faces *= 4;  // when twisting, we do more. TODO: calculate better.
   }
+  result.reserve(faces);
   for (int f = 0; f < faces; ++f) {
     const double angle = 1.0 * f / faces;
     double pol_value = fun.value(angle);
@@ -0,0 +1,38 @@
+/* -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+ * (c) 2014 Henner Zeller <h.zeller@acm.org>
+ * Creative commons BY-SA
+ */
+
+// Replaces the global operator new/delete to count allocations and to serve
+// them from a ScratchArena if one is active. Not part of the library: this
+// is a decision of the program, which might bring its own allocator.
+
+#include "scratch-arena.h"
+
+#include <stdlib.h>
+
+#include <atomic>
+#include <new>
+
+static std::atomic<long> sHeapAllocationCount(0);
+
+void *operator new(std::size_t size) {
+  void *result = ScratchArena::Allocate(size);
+  if (result)
+    return result;
+  sHeapAllocationCount.fetch_add(1, std::memory_order_relaxed);
+  result = malloc(size ? size : 1);
+  if (result == NULL) throw std::bad_alloc();
+  return result;
+}
+
+void operator delete(void *p) noexcept {
+  if (ScratchArena::Owns(p))
+    return;  // Reclaimed when the arena is reset.
+  free(p);
+}
+void operator delete(void *p, std::size_t) noexcept { operator delete(p); }
+
+long GetHeapAllocationCount() {
+  return sHeapAllocationCount.load(std::memory_order_relaxed);
+}
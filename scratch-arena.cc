@@ -0,0 +1,106 @@
+/* -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+ * (c) 2014 Henner Zeller <h.zeller@acm.org>
+ * Creative commons BY-SA
+ */
+
+#include "scratch-arena.h"
+
+#include <stdlib.h>
+
+#include <atomic>
+
+namespace {
+const size_t kChunkSize = 1 << 20;
+const int kMaxChunks = 32;  // If we need more, fall back to the heap.
+const size_t kAlignment = 16;
+
+// Per-thread state. Plain data, so that it is usable from operator delete
+// at any time of the thread's life. The memory is not allocated with
+// operator new for obvious reasons.
+struct ArenaState {
+  int scope_depth;
+  int suspend_depth;
+  int chunk_count;
+  int current_chunk;
+  size_t used;       // in current chunk
+  char *chunk[kMaxChunks];
+  size_t chunk_size[kMaxChunks];
+};
+
+thread_local ArenaState sArena;
+
+// Releases the chunks when the thread ends.
+struct ArenaCleanup {
+  ~ArenaCleanup() {
+    for (int i = 0; i < sArena.chunk_count; ++i)
+      free(sArena.chunk[i]);
+    sArena.chunk_count = 0;
+  }
+};
+thread_local ArenaCleanup sArenaCleanup;
+
+std::atomic<long> sArenaAllocationCount(0);
+
+void *ArenaAllocate(size_t size) {
+  ArenaState &a = sArena;
+  (void) sArenaCleanup;  // Make sure it is instantiated for this thread.
+  size = (size + kAlignment - 1) & ~(kAlignment - 1);
+  while (a.current_chunk < a.chunk_count) {
+    if (a.used + size <= a.chunk_size[a.current_chunk]) {
+      void *result = a.chunk[a.current_chunk] + a.used;
+      a.used += size;
+      return result;
+    }
+    a.current_chunk++;
+    a.used = 0;
+  }
+  if (a.chunk_count == kMaxChunks)
+    return NULL;
+  const size_t chunk_size = size > kChunkSize ? size : kChunkSize;
+  char *chunk = (char*) malloc(chunk_size);
+  if (chunk == NULL)
+    return NULL;
+  a.chunk[a.chunk_count] = chunk;
+  a.chunk_size[a.chunk_count] = chunk_size;
+  a.current_chunk = a.chunk_count++;
+  a.used = size;
+  return chunk;
+}
+
+bool IsArenaMemory(void *p) {
+  const ArenaState &a = sArena;
+  for (int i = 0; i < a.chunk_count; ++i) {
+    if (p >= a.chunk[i] && p < a.chunk[i] + a.chunk_size[i])
+      return true;
+  }
+  return false;
+}
+}  // namespace
+
+void *ScratchArena::Allocate(size_t size) {
+  if (sArena.scope_depth == 0 || sArena.suspend_depth > 0)
+    return NULL;
+  void *result = ArenaAllocate(size);
+  if (result)
+    sArenaAllocationCount.fetch_add(1, std::memory_order_relaxed);
+  return result;
+}
+
+bool ScratchArena::Owns(void *p) {
+  return sArena.chunk_count > 0 && IsArenaMemory(p);
+}
+
+ScratchArena::Scope::Scope() { sArena.scope_depth++; }
+ScratchArena::Scope::~Scope() {
+  if (--sArena.scope_depth == 0) {
+    sArena.current_chunk = 0;
+    sArena.used = 0;
+  }
+}
+
+ScratchArena::Suspend::Suspend() { sArena.suspend_depth++; }
+ScratchArena::Suspend::~Suspend() { sArena.suspend_depth--; }
+
+long ScratchArena::allocation_count() {
+  return sArenaAllocationCount.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,61 @@
+/* -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+ * (c) 2014 Henner Zeller <h.zeller@acm.org>
+ * Creative commons BY-SA
+ */
+#ifndef SHELL_EXTRUDE_SCRATCH_ARENA_H_
+#define SHELL_EXTRUDE_SCRATCH_ARENA_H_
+
+#include <stddef.h>
+
+// Bump allocator for short-lived temporary memory, such as the many small
+// vectors the clipper library creates while offsetting.
+//
+// While a ScratchArena::Scope is alive, Allocate() on that thread serves
+// memory from a per-thread arena. When the outermost scope ends, the arena
+// is reset; its memory is kept for the next scope, so after warm-up there
+// are no calls to malloc() anymore.
+//
+// The library does not touch the global operator new; a program that wants
+// all allocations within a scope to go to the arena links
+// scratch-arena-new.o, as the commandline tool does. Without it, scopes
+// have no effect.
+//
+// Everything allocated inside a scope needs to be destroyed before the scope
+// ends. Results that should outlive it need to be allocated outside or
+// within a ScratchArena::Suspend.
+class ScratchArena {
+public:
+  class Scope {
+  public:
+    Scope();
+    ~Scope();
+  private:
+    Scope(const Scope&);
+  };
+
+  // Temporarily allocate from the regular heap.
+  class Suspend {
+  public:
+    Suspend();
+    ~Suspend();
+  private:
+    Suspend(const Suspend&);
+  };
+
+  // Memory from this thread's arena if a scope is active and not
+  // suspended, otherwise NULL.
+  static void *Allocate(size_t size);
+
+  // Returns true if "p" is memory of this thread's arena. It is reclaimed
+  // when the arena is reset and must not be freed.
+  static bool Owns(void *p);
+
+  // Number of allocations served from arenas so far, all threads.
+  static long allocation_count();
+};
+
+// Number of regular heap allocations with operator new so far, all threads.
+// Counted by the operator new in scratch-arena-new.cc.
+long GetHeapAllocationCount();
+
+#endif  // SHELL_EXTRUDE_SCRATCH_ARENA_H_
@@ -0,0 +1,260 @@
+/* -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+ * (c) 2014 Henner Zeller <h.zeller@acm.org>
+ * Creative commons BY-SA
+ */
+
+#include "server.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "output-sink.h"
+
+// Requests are small; anything larger is not from us.
+static const uint32_t kMaxRequestSize = 1 << 20;
+
+static bool WriteFully(int fd, const char *data, size_t len) {
+  while (len > 0) {
+    const ssize_t written = write(fd, data, len);
+    if (written < 0 && errno == EINTR)
+      continue;
+    if (written <= 0)
+      return false;
+    data += written;
+    len -= written;
+  }
+  return true;
+}
+
+static bool ReadFully(int fd, char *data, size_t len) {
+  while (len > 0) {
+    const ssize_t r = read(fd, data, len);
+    if (r < 0 && errno == EINTR)
+      continue;
+    if (r <= 0)
+      return false;
+    data += r;
+    len -= r;
+  }
+  return true;
+}
+
+static void EncodeLength(uint32_t len, char *out) {
+  out[0] = len >> 24; out[1] = len >> 16; out[2] = len >> 8; out[3] = len;
+}
+
+static uint32_t DecodeLength(const char *in) {
+  const uint8_t *b = (const uint8_t*) in;
+  return (b[0] << 24) | (b[1] << 16) | (b[2] << 8) | b[3];
+}
+
+static bool WriteFrame(int fd, char type, const char *data, size_t len) {
+  char header[5];
+  header[0] = type;
+  EncodeLength(len, header + 1);
+  return WriteFully(fd, header, sizeof(header)) && WriteFully(fd, data, len);
+}
+
+static bool UnixSocketAddress(const char *path, struct sockaddr_un *addr) {
+  memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr->sun_path)) {
+    fprintf(stderr, "Socket path too long: %s\n", path);
+    return false;
+  }
+  strncpy(addr->sun_path, path, sizeof(addr->sun_path) - 1);
+  return true;
+}
+
+namespace {
+// Sends everything written as frames of the given type. Collects up to
+// "buffer_size" bytes before sending. If the client went away, the rest
+// is dropped.
+class FrameSink : public OutputSink {
+public:
+  FrameSink(int fd, char type, size_t buffer_size)
+    : fd_(fd), type_(type), buffer_size_(buffer_size), broken_(false) {}
+  virtual ~FrameSink() { Flush(); }
+
+  virtual void Write(const char *data, size_t len) {
+    buffer_.append(data, len);
+    if (buffer_.size() >= buffer_size_)
+      Flush();
+  }
+
+  void Flush() {
+    if (!buffer_.empty() && !broken_)
+      broken_ = !WriteFrame(fd_, type_, buffer_.data(), buffer_.size());
+    buffer_.clear();
+  }
+
+private:
+  const int fd_;
+  const char type_;
+  const size_t buffer_size_;
+  bool broken_;
+  std::string buffer_;
+};
+
+// Connections waiting for a worker.
+class ConnectionQueue {
+public:
+  void Push(int fd) {
+    std::lock_guard<std::mutex> l(mutex_);
+    queue_.push_back(fd);
+    available_.notify_one();
+  }
+  int Pop() {
+    std::unique_lock<std::mutex> l(mutex_);
+    available_.wait(l, [this]() { return !queue_.empty(); });
+    const int fd = queue_.front();
+    queue_.pop_front();
+    return fd;
+  }
+
+private:
+  std::mutex mutex_;
+  std::condition_variable available_;
+  std::deque<int> queue_;
+};
+}  // end anonymous namespace.
+
+static void HandleConnection(Generator *generator, int workers, int fd) {
+  char header[4];
+  std::string request;
+  if (!ReadFully(fd, header, sizeof(header))
+      || DecodeLength(header) > kMaxRequestSize)
+    return;
+  request.resize(DecodeLength(header));
+  if (!ReadFully(fd, &request[0], request.size()))
+    return;
+
+  GenerateResult result = GENERATE_CONFIG_ERROR;
+  {
+    FrameSink out(fd, 'O', 65536);
+    FrameSink log(fd, 'L', 0);   // Log messages are sent right away.
+    GeneratorConfig config;
+    if (ConfigFromString(request, &config)) {
+      // With several workers, the cores are busy with other requests.
+      if (workers > 1 && config.threads == 0)
+        config.threads = 1;
+      result = generator->Generate(config, &out, &log);
+    } else {
+      log.Printf("Invalid request\n");
+    }
+  }
+  const char result_byte = result;
+  WriteFrame(fd, 'R', &result_byte, 1);
+}
+
+static void Worker(ConnectionQueue *queue, int workers,
+                   const std::string &cache_dir) {
+  Generator generator;   // Kept for all requests, so polygons stay warm.
+  generator.SetCacheDir(cache_dir);
+  for (;;) {
+    const int fd = queue->Pop();
+    HandleConnection(&generator, workers, fd);
+    close(fd);
+  }
+}
+
+bool RunServer(const char *path, int workers, const std::string &cache_dir) {
+  struct sockaddr_un addr;
+  if (!UnixSocketAddress(path, &addr))
+    return false;
+  const int server_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (server_fd < 0) {
+    perror("socket");
+    return false;
+  }
+  unlink(path);   // Left over from a previous run.
+  if (bind(server_fd, (struct sockaddr*) &addr, sizeof(addr)) < 0
+      || listen(server_fd, 64) < 0) {
+    perror(path);
+    close(server_fd);
+    return false;
+  }
+  signal(SIGPIPE, SIG_IGN);  // Clients going away is not our problem.
+
+  ConnectionQueue queue;
+  std::vector<std::thread> threads;
+  workers = std::max(1, workers);
+  for (int i = 0; i < workers; ++i)
+    threads.push_back(std::thread(Worker, &queue, workers, cache_dir));
+  fprintf(stderr, "Serving on %s with %d workers\n",
+          path, (int) threads.size());
+  for (;;) {
+    const int fd = accept(server_fd, NULL, NULL);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      perror("accept");
+      break;
+    }
+    queue.Push(fd);
+  }
+  // Workers are blocked in the queue; we're going to exit anyway.
+  for (size_t i = 0; i < threads.size(); ++i)
+    threads[i].detach();
+  close(server_fd);
+  return false;
+}
+
+GenerateResult RequestFromServer(const char *path,
+                                 const GeneratorConfig &config,
+                                 OutputSink *out, OutputSink *log) {
+  struct sockaddr_un addr;
+  if (!UnixSocketAddress(path, &addr))
+    return GENERATE_FAILED;
+  const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0 || connect(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
+    perror(path);
+    if (fd >= 0) close(fd);
+    return GENERATE_FAILED;
+  }
+
+  GeneratorConfig request_config = config;
+  if (!config.polygon_file.empty() && config.polygon_file[0] != '/') {
+    char cwd[4096];
+    if (getcwd(cwd, sizeof(cwd)) != NULL) {
+      request_config.polygon_file
+        = std::string(cwd) + "/" + config.polygon_file;
+    }
+  }
+  const std::string request = ConfigToString(request_config);
+  char header[5];
+  EncodeLength(request.size(), header);
+  GenerateResult result = GENERATE_FAILED;
+  if (WriteFully(fd, header, 4)
+      && WriteFully(fd, request.data(), request.size())) {
+    std::string data;
+    while (ReadFully(fd, header, 5)) {
+      data.resize(DecodeLength(header + 1));
+      if (!ReadFully(fd, &data[0], data.size()))
+        break;
+      if (header[0] == 'O' && out) {
+        out->Write(data.data(), data.size());
+      } else if (header[0] == 'L' && log) {
+        log->Write(data.data(), data.size());
+      } else if (header[0] == 'R' && data.size() == 1) {
+        result = (GenerateResult) data[0];
+        break;
+      }
+    }
+  }
+  close(fd);
+  return result;
+}
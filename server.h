@@ -0,0 +1,39 @@
+/* -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+ * (c) 2014 Henner Zeller <h.zeller@acm.org>
+ * Creative commons BY-SA
+ */
+#ifndef SHELL_EXTRUDE_SERVER_H_
+#define SHELL_EXTRUDE_SERVER_H_
+
+#include <string>
+
+#include "generator.h"
+
+class OutputSink;
+
+// Generating as a service on a Unix domain socket. Clients don't pay for
+// process startup, and the workers keep the polygons of previous jobs.
+//
+// A request is the GeneratorConfig as text (see ConfigToString()), prefixed
+// by its length as 32 bit big endian. The response is a sequence of frames,
+// each a type byte, a 32 bit big endian length and the data:
+//   'O': output    'L': log    'R': end; a single byte GenerateResult.
+// Output is streamed as it is generated; header values such as
+// --header-totals are worked out before (see Printer::SetTotals()), so they
+// are in the header as with any other output.
+
+// Serve requests on a socket created at "path" with "workers" threads, each
+// with its own Generator. If "cache_dir" is not empty, it is used as disk
+// cache (see Generator::SetCacheDir()). Only returns on error, after writing
+// a message to stderr.
+bool RunServer(const char *path, int workers, const std::string &cache_dir);
+
+// Have the server at "path" generate the config, output and log are passed
+// on to "out" and "log" (can be NULL). A relative polygon file is made
+// absolute, as the server might run in a different directory. Returns
+// GENERATE_FAILED if the server can't be reached.
+GenerateResult RequestFromServer(const char *path,
+                                 const GeneratorConfig &config,
+                                 OutputSink *out, OutputSink *log);
+
+#endif  // SHELL_EXTRUDE_SERVER_H_
@@ -0,0 +1,140 @@
+/* -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+ * (c) 2014 Henner Zeller <h.zeller@acm.org>
+ * Creative commons BY-SA
+ */
+
+#include "travel.h"
+
+#include <algorithm>
+
+static double cross(const Vector2D &a, const Vector2D &b) {
+  return a.x * b.y - a.y * b.x;
+}
+
+CombingPlanner::CombingPlanner(const Polygon &region)
+  : region_(region), circumference_(0) {
+  circumference_pos_.reserve(region_.size());
+  for (size_t i = 0; i < region_.size(); ++i) {
+    if (i > 0) circumference_ += (region_[i] - region_[i-1]).magnitude();
+    circumference_pos_.push_back(circumference_);
+  }
+  if (!region_.empty())
+    circumference_ += (region_[0] - region_[region_.size()-1]).magnitude();
+}
+
+bool CombingPlanner::Contains(const Vector2D &p) const {
+  bool inside = false;
+  const int n = region_.size();
+  for (int i = 0, j = n - 1; i < n; j = i++) {
+    const Vector2D &a = region_[i];
+    const Vector2D &b = region_[j];
+    if ((a.y > p.y) != (b.y > p.y)
+        && p.x < (b.x - a.x) * (p.y - a.y) / (b.y - a.y) + a.x) {
+      inside = !inside;
+    }
+  }
+  return inside;
+}
+
+double CombingPlanner::BoundaryPosition(int edge, const Vector2D &point) const {
+  return circumference_pos_[edge] + (point - region_[edge]).magnitude();
+}
+
+Vector2D CombingPlanner::ClosestBoundaryPoint(const Vector2D &p) const {
+  Vector2D best = region_[0];
+  double best_dist = -1;
+  const int n = region_.size();
+  for (int i = 0; i < n; ++i) {
+    const Vector2D &a = region_[i];
+    const Vector2D &b = region_[(i + 1) % n];
+    const Vector2D ab = b - a;
+    const double len_sq = ab.x * ab.x + ab.y * ab.y;
+    double t = (len_sq > 0)
+      ? ((p.x - a.x) * ab.x + (p.y - a.y) * ab.y) / len_sq
+      : 0;
+    t = std::max(0.0, std::min(1.0, t));
+    const Vector2D candidate = a + ab * t;
+    const double dist = (candidate - p).magnitude();
+    if (best_dist < 0 || dist < best_dist) {
+      best = candidate;
+      best_dist = dist;
+    }
+  }
+  return best;
+}
+
+bool CombingPlanner::Plan(const Vector2D &from, const Vector2D &to,
+                          std::vector<Vector2D> *path) const {
+  if (region_.size() < 3 || !Contains(from))
+    return false;
+  const Vector2D target = Contains(to) ? to : ClosestBoundaryPoint(to);
+
+  // All places where the straight line crosses the boundary. Crossings
+  // right at the end don't count: the target might be on the boundary.
+  const double kEpsilon = 1e-6;
+  const Vector2D d = target - from;
+  Crossing first = { 2, -1, Vector2D() };
+  Crossing last = { -1, -1, Vector2D() };
+  const int n = region_.size();
+  for (int i = 0; i < n; ++i) {
+    const Vector2D &a = region_[i];
+    const Vector2D e = region_[(i + 1) % n] - a;
+    const double denom = cross(d, e);
+    if (denom == 0)
+      continue;  // parallel
+    const double t = cross(a - from, e) / denom;
+    const double u = cross(a - from, d) / denom;
+    if (t <= kEpsilon || t >= 1 - kEpsilon || u < 0 || u > 1)
+      continue;
+    const Crossing c = { t, i, from + d * t };
+    if (t < first.t) first = c;
+    if (t > last.t) last = c;
+  }
+
+  if (first.edge >= 0) {
+    // Walk along the boundary from where we'd leave the region to where we
+    // would come back, in whichever direction is shorter.
+    const double from_pos = BoundaryPosition(first.edge, first.point);
+    const double to_pos = BoundaryPosition(last.edge, last.point);
+    double forward_len = to_pos - from_pos;
+    if (forward_len < 0) forward_len += circumference_;
+    const bool forward = forward_len <= circumference_ - forward_len;
+    path->push_back(first.point);
+    if (forward) {
+      for (int i = (first.edge + 1) % n; i != (last.edge + 1) % n;
+           i = (i + 1) % n) {
+        path->push_back(region_[i]);
+      }
+    } else {
+      for (int i = first.edge; i != last.edge; i = (i + n - 1) % n) {
+        path->push_back(region_[i]);
+      }
+    }
+    path->push_back(last.point);
+  }
+  path->push_back(target);
+  if ((to - target).magnitude() > kEpsilon)
+    path->push_back(to);
+  return true;
+}
+
+int ClosestVertex(const Polygon &polygon, const Vector2D &p) {
+  int best = 0;
+  double best_dist = -1;
+  for (size_t i = 0; i < polygon.size(); ++i) {
+    const double dist = (polygon[i] - p).magnitude();
+    if (best_dist < 0 || dist < best_dist) {
+      best = i;
+      best_dist = dist;
+    }
+  }
+  return best;
+}
+
+Polygon RotatePolygonStart(const Polygon &polygon, int start_index) {
+  Polygon result;
+  result.reserve(polygon.size());
+  for (size_t i = 0; i < polygon.size(); ++i)
+    result.push_back(polygon[(i + start_index) % polygon.size()]);
+  return result;
+}
@@ -0,0 +1,53 @@
+/* -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+ * (c) 2014 Henner Zeller <h.zeller@acm.org>
+ * Creative commons BY-SA
+ */
+#ifndef SHELL_EXTRUDE_TRAVEL_H_
+#define SHELL_EXTRUDE_TRAVEL_H_
+
+#include <vector>
+
+#include "multi-shell-extrude.h"
+
+// Plans travel moves that stay within a region, typically the part we are
+// printing ("combing"). As we never leave the part, there is no need to
+// retract or lift the nozzle, and no strings are pulled across gaps.
+class CombingPlanner {
+public:
+  explicit CombingPlanner(const Polygon &region);
+
+  // Returns true if the point is inside the region.
+  bool Contains(const Vector2D &p) const;
+
+  // Plan travel from "from" to "to". Appends waypoints to "path", the last
+  // one being "to". The path follows the region boundary where the straight
+  // line would leave it. If "to" is outside, the path goes to the closest
+  // point of the region first and leaves from there.
+  // Returns false if "from" is not inside the region; the path is
+  // unchanged then.
+  bool Plan(const Vector2D &from, const Vector2D &to,
+            std::vector<Vector2D> *path) const;
+
+private:
+  struct Crossing {
+    double t;        // Position along the travel line.
+    int edge;
+    Vector2D point;
+  };
+
+  // Position along the circumference of a point on the given edge.
+  double BoundaryPosition(int edge, const Vector2D &point) const;
+  Vector2D ClosestBoundaryPoint(const Vector2D &p) const;
+
+  Polygon region_;
+  std::vector<double> circumference_pos_;  // At each vertex.
+  double circumference_;
+};
+
+// Index of the polygon vertex that is closest to "p".
+int ClosestVertex(const Polygon &polygon, const Vector2D &p);
+
+// Returns the same polygon, just starting with vertex "start_index".
+Polygon RotatePolygonStart(const Polygon &polygon, int start_index);
+
+#endif  // SHELL_EXTRUDE_TRAVEL_H_